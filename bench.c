@@ -0,0 +1,367 @@
+/***
+ * @file bench.c
+ * @brief load generator for the chat server (throughput / latency)
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ *
+ * -s pads every message with chat-like text up to that many bytes. The
+ * bare tag is about 27 bytes, below COMPRESS_MIN_LEN, so deflate runs only
+ * get compressed with -s 128 or more.
+ * -i runs the receivers' ingest stage on canned messages instead, in this
+ * process and without a server, and prints the cost per message of every
+ * step at every SIMD level the CPU has.
+ */
+
+/* HEADERS */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+
+#include "chat_proto.h"
+#include "conn.h"
+#include "ingest.h"
+
+/* DEFINE */
+#define SERVER_IP "127.0.0.1"
+#define SERVER_PORT 9999
+#define TLS_CA_ENV "CHAT_TLS_CA" /* CA file to verify the server with, unset : the system CA store */
+#define BENCH_TAG "BENCH"
+#define BENCH_MAX_CLIENTS 512
+#define BENCH_IDLE_TIMEOUT_MS 2000 /* receivers give up after this long without data */
+#define BENCH_INGEST_ROUNDS 1000000
+#define BENCH_MAX_SIZE 1000 /* -s limit, below the body the server relays uncut */
+#define BENCH_FILLER " the build is green again, pushed the fix and bumped the batch window"
+
+/* STRUCTS */
+typedef struct
+{
+    Conn conn;
+    int received;
+    long *latency_ns;
+    long last_recv_ns;
+} BenchClient;
+
+/* FUNCTIONS */
+static long now_ns();
+static int bench_connect(Conn *conn, uint16_t port, const char *local_path, SSL_CTX *tls_ctx, int idx, int codec);
+static int cmp_long(const void *a, const void *b);
+static void bench_ingest(const char *terms_path);
+void *bench_receiver(void *arg);
+
+/* GLOBAL VARIABLES */
+int g_messages = 1000;
+volatile size_t g_sink; // keeps the ingest loops from being optimized away
+
+/* MAIN */
+int main(int argc, char *argv[])
+{
+    int opt;
+    int clients = 3;
+    int rate = 0; // msgs/sec, 0 : flood
+    int codec = CODEC_PLAIN;
+    uint16_t port = SERVER_PORT;
+    const char *local_path = NULL; // shared memory transport instead of TCP
+    SSL_CTX *tls_ctx = NULL;       // TLS to the server's -t port
+    char transport[32]; // "shm", "tcp" or "tls, " + where the records are done
+    int size = 0; // message bytes, 0 : the bare tag
+    int msg_len = 0; // bytes of the last message sent, for the report
+    char send_buf[BENCH_MAX_SIZE + 1];
+    uint8_t frame[FRAME_MAX_SIZE];
+    BenchClient bc[BENCH_MAX_CLIENTS];
+    pthread_t tids[BENCH_MAX_CLIENTS];
+    long first_send_ns, last_recv_ns = 0, total = 0, sum_ns = 0;
+    long *all;
+
+    signal(SIGPIPE, SIG_IGN); // OpenSSL writes with write(2), a vanished server must be an error and not a signal
+    while ((opt = getopt(argc, argv, "p:c:m:r:z:s:u:ti:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'p':
+            port = atoi(optarg);
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'm':
+            g_messages = atoi(optarg);
+            break;
+        case 'r':
+            rate = atoi(optarg);
+            break;
+        case 'z':
+            codec = codec_from_name(optarg);
+            break;
+        case 's':
+            size = atoi(optarg);
+            break;
+        case 'u':
+            local_path = optarg;
+            break;
+        case 't':
+            if ((tls_ctx = tls_client_ctx(getenv(TLS_CA_ENV))) == NULL)
+            {
+                fprintf(stdout, "[BENCH] TLS setup failed, check %s\n", TLS_CA_ENV);
+                return EXIT_FAILURE;
+            }
+            break;
+        case 'i': // ingest micro benchmark with these banned terms, no server
+            bench_ingest(optarg);
+            return EXIT_SUCCESS;
+        default:
+            fprintf(stdout, "[BENCH] Usage: %s [-p port [-t] | -u local_socket_path] [-c clients] [-m messages] [-r rate] [-z none|deflate] [-s bytes] | -i banned_terms_path\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (clients < 1 || clients > BENCH_MAX_CLIENTS || g_messages < 1 || size < 0 || size > BENCH_MAX_SIZE)
+    {
+        fprintf(stdout, "[BENCH] bad option, 1 <= clients <= %d, messages >= 1, 0 <= bytes <= %d\n", BENCH_MAX_CLIENTS,
+                BENCH_MAX_SIZE);
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < clients; i++)
+    {
+        bc[i] = (BenchClient){.received = 0};
+        if (bench_connect(&bc[i].conn, port, local_path, tls_ctx, i, codec) < 0)
+        {
+            fprintf(stdout, "[BENCH] client %d could not join\n", i);
+            exit(EXIT_FAILURE);
+        }
+        bc[i].latency_ns = calloc(g_messages, sizeof(long));
+        pthread_create(&tids[i], NULL, bench_receiver, &bc[i]);
+    }
+    usleep(200 * 1000); // let the join notices drain
+    snprintf(transport, sizeof(transport), "%s%s", (local_path != NULL) ? "shm" : (tls_ctx == NULL) ? "tcp" : "tls, ",
+             (local_path == NULL && tls_ctx != NULL) ? tls_records_name(bc[0].conn.ssl) : "");
+
+    /* client 0 floods (or paces) the room */
+    first_send_ns = now_ns();
+    for (int i = 0; i < g_messages; i++)
+    {
+        int len = snprintf(send_buf, sizeof(send_buf), BENCH_TAG " %d %ld", i, now_ns());
+
+        while (len < size) // receivers only parse the tag, the filler is for the codec
+        {
+            int n = (size - len < (int)strlen(BENCH_FILLER)) ? size - len : (int)strlen(BENCH_FILLER);
+
+            memcpy(send_buf + len, BENCH_FILLER, n);
+            len += n;
+        }
+        msg_len = len;
+        if (conn_send_all(&bc[0].conn, frame, frame_build(frame, sizeof(frame), FRAME_CHAT, 0, CODEC_PLAIN, NULL, send_buf, len)) < 0)
+        {
+            fprintf(stdout, "[BENCH] send failed at message %d\n", i);
+            break;
+        }
+        if (rate > 0)
+        {
+            long next_ns = first_send_ns + (long)(i + 1) * 1000000000L / rate;
+            long wait_ns = next_ns - now_ns();
+            if (wait_ns > 0)
+                usleep(wait_ns / 1000);
+        }
+    }
+
+    for (int i = 0; i < clients; i++)
+    {
+        pthread_join(tids[i], NULL);
+        total += bc[i].received;
+        if (bc[i].last_recv_ns > last_recv_ns)
+            last_recv_ns = bc[i].last_recv_ns;
+    }
+
+    all = malloc(((total > 0) ? total : 1) * sizeof(long));
+    for (int i = 0, k = 0; i < clients; i++)
+    {
+        for (int j = 0; j < bc[i].received; j++)
+        {
+            all[k++] = bc[i].latency_ns[j];
+            sum_ns += bc[i].latency_ns[j];
+        }
+        free(bc[i].latency_ns);
+        conn_close(&bc[i].conn);
+    }
+    qsort(all, total, sizeof(long), cmp_long);
+
+    fprintf(stdout, "[BENCH] clients %d, messages %d (%d bytes), codec %s, transport %s\n", clients, g_messages,
+            msg_len, codec_name(codec), transport);
+    fprintf(stdout, "[BENCH] delivered %ld / %ld (%.1f%%)\n", total, (long)clients * g_messages,
+            100.0 * total / ((double)clients * g_messages));
+    if (total > 0)
+    {
+        fprintf(stdout, "[BENCH] throughput %.0f msgs/s\n", total / ((last_recv_ns - first_send_ns) / 1e9));
+        fprintf(stdout, "[BENCH] latency avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+                sum_ns / (double)total / 1e3, all[total / 2] / 1e3, all[total * 99 / 100] / 1e3, all[total - 1] / 1e3);
+    }
+    free(all);
+    SSL_CTX_free(tls_ctx);
+    return EXIT_SUCCESS;
+}
+
+/* Other Functions */
+static long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+    long x = *(const long *)a, y = *(const long *)b;
+    return (x > y) - (x < y);
+}
+
+/* ns per message of each ingest step, copies are timed alone and taken out of the in place steps */
+static void bench_ingest(const char *terms_path)
+{
+    static const struct
+    {
+        const char *name;
+        const char *text;
+    } samples[] = {
+        {"ascii short", "see you at 3pm!"},
+        {"ascii long", "the build is green again, I pushed the fix for the flaky federation test and bumped the batch window to 500 usec"},
+        {"korean", "\xEC\x95\x88\xEB\x85\x95\xED\x95\x98\xEC\x84\xB8\xEC\x9A\x94 \xEC\x98\xA4\xEB\x8A\x98 \xED\x9A\x8C\xEC\x9D\x98\xEB\x8A\x94 "
+                   "\xEC\x84\xB8 \xEC\x8B\x9C\xEC\x97\x90 \xEC\x8B\x9C\xEC\x9E\x91\xED\x95\xA9\xEB\x8B\x88\xEB\x8B\xA4, \xEB\x8A\xA6\xEC\xA7\x80 "
+                   "\xEB\xA7\x88\xEC\x84\xB8\xEC\x9A\x94!"},
+        {"controls", "first line\r\nsecond line\tand a bell\x07 at the end\r\n"},
+    };
+    static const char *level_names[] = {"scalar", "sse", "avx2"};
+    char buf[MESSAGE_MAX_LEN + 1];
+    AcMatcher *ac;
+    IngestMsg msg;
+    long start_ns, copy_ns, utf8_ns, strip_ns, terms_ns, run_ns;
+
+    if (ingest_load_terms(terms_path) < 0 || (ac = ac_load(terms_path)) == NULL)
+        exit(EXIT_FAILURE);
+    fprintf(stdout, "[BENCH] ingest, %d banned terms (%d states, %d byte classes), ns per message\n",
+            ac->terms, ac->states, ac->classes);
+    fprintf(stdout, "[BENCH] %-12s %5s %-7s %8s %8s %8s %8s\n", "message", "bytes", "simd", "utf8", "controls", "terms", "pipeline");
+    for (size_t m = 0; m < sizeof(samples) / sizeof(samples[0]); m++)
+    {
+        size_t len = strlen(samples[m].text);
+
+        for (int level = INGEST_SIMD_SCALAR; level <= INGEST_SIMD_AVX2; level++)
+        {
+            if ((level == INGEST_SIMD_SSE && !__builtin_cpu_supports("ssse3")) ||
+                (level == INGEST_SIMD_AVX2 && !__builtin_cpu_supports("avx2")))
+                continue;
+            g_ingest_simd = level;
+
+            start_ns = now_ns();
+            for (int r = 0; r < BENCH_INGEST_ROUNDS; r++)
+            {
+                memcpy(buf, samples[m].text, len);
+                g_sink += buf[r % len];
+            }
+            copy_ns = now_ns() - start_ns;
+
+            start_ns = now_ns();
+            for (int r = 0; r < BENCH_INGEST_ROUNDS; r++)
+            {
+                g_sink += ingest_utf8_valid((const uint8_t *)samples[m].text, len);
+            }
+            utf8_ns = now_ns() - start_ns;
+
+            start_ns = now_ns();
+            for (int r = 0; r < BENCH_INGEST_ROUNDS; r++)
+            {
+                memcpy(buf, samples[m].text, len);
+                g_sink += ingest_strip_controls(buf, len);
+            }
+            strip_ns = now_ns() - start_ns - copy_ns;
+
+            start_ns = now_ns();
+            for (int r = 0; r < BENCH_INGEST_ROUNDS; r++)
+            {
+                memcpy(buf, samples[m].text, len);
+                g_sink += ac_censor(ac, buf, len);
+            }
+            terms_ns = now_ns() - start_ns - copy_ns;
+
+            start_ns = now_ns();
+            for (int r = 0; r < BENCH_INGEST_ROUNDS; r++)
+            {
+                memcpy(buf, samples[m].text, len);
+                msg = (IngestMsg){.data = buf, .len = len};
+                g_sink += ingest_run(&msg);
+            }
+            run_ns = now_ns() - start_ns - copy_ns;
+
+            fprintf(stdout, "[BENCH] %-12s %5zu %-7s %8.1f %8.1f %8.1f %8.1f\n", samples[m].name, len, level_names[level],
+                    (double)utf8_ns / BENCH_INGEST_ROUNDS, (double)strip_ns / BENCH_INGEST_ROUNDS,
+                    (double)terms_ns / BENCH_INGEST_ROUNDS, (double)run_ns / BENCH_INGEST_ROUNDS);
+        }
+    }
+    ac_free(ac);
+    ingest_cleanup();
+}
+
+static int bench_connect(Conn *conn, uint16_t port, const char *local_path, SSL_CTX *tls_ctx, int idx, int codec)
+{
+    int sockfd;
+    char buf[1024];
+    struct sockaddr_in server_address = {.sin_family = AF_INET, .sin_port = htons(port)};
+
+    if (local_path != NULL)
+    {
+        if (conn_local_connect(conn, local_path, buf, sizeof(buf)) <= 0)
+            return -1;
+    }
+    else
+    {
+        inet_pton(AF_INET, SERVER_IP, &(server_address.sin_addr));
+        if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            return -1;
+        conn_tcp(conn, sockfd);
+        if (connect(sockfd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0 ||
+            (tls_ctx != NULL && conn_tls(conn, sockfd, tls_ctx, SERVER_IP) < 0))
+        {
+            close(sockfd);
+            return -1;
+        }
+        if (conn_hello_recv(conn, buf, sizeof(buf)) <= 0) // welcome message, nothing if the server is full
+        {
+            conn_close(conn);
+            return -1;
+        }
+    }
+    snprintf(buf, sizeof(buf), "bench%d%c%s", idx, HANDSHAKE_CODEC_SEP, codec_name(codec));
+    conn_hello_send(conn, buf, strlen(buf));
+    conn_set_timeout(conn, BENCH_IDLE_TIMEOUT_MS);
+    return 0;
+}
+
+void *bench_receiver(void *arg)
+{
+    BenchClient *bc = (BenchClient *)arg;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    char text[MESSAGE_MAX_LEN + 1];
+    z_stream inflate_stream = {0};
+    FrameHeader hdr;
+    char *tag;
+    int seq;
+    long sent_ns;
+
+    inflateInit(&inflate_stream);
+    while (bc->received < g_messages && conn_frame_read(&bc->conn, &hdr, payload, sizeof(payload)) > 0)
+    {
+        if (frame_decode(&hdr, &inflate_stream, payload, text, sizeof(text)) < 0)
+            continue;
+        if ((tag = strstr(text, BENCH_TAG " ")) == NULL)
+            continue; // join notices
+        if (sscanf(tag, BENCH_TAG " %d %ld", &seq, &sent_ns) != 2)
+            continue;
+        bc->last_recv_ns = now_ns();
+        bc->latency_ns[bc->received++] = bc->last_recv_ns - sent_ns;
+    }
+    inflateEnd(&inflate_stream);
+    pthread_exit(NULL);
+}
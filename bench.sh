@@ -0,0 +1,50 @@
+#!/bin/sh
+# Runs the load generator against a fresh server for several batch windows.
+# usage : ./bench.sh [messages] [clients] [rate msgs/s, 0 : flood] [codec] [tcp|tls|shm] [bytes]
+# bytes pads the messages (bench -s), deflate defaults to 256 since shorter ones are never compressed
+PORT=9998
+TLS_PORT=9997
+LOCAL_PATH=/tmp/chat_bench.sock
+TLS_CERT=/tmp/chat_bench_cert.pem
+TLS_KEY=/tmp/chat_bench_key.pem
+MESSAGES=${1:-2000}
+CLIENTS=${2:-3}
+RATE=${3:-20000}
+CODEC=${4:-none}
+TRANSPORT=${5:-tcp}
+if [ "$CODEC" = deflate ]; then SIZE=${6:-256}; else SIZE=${6:-0}; fi
+
+case "$TRANSPORT" in
+tls) # kTLS if the kernel has the tls module, the bench trusts this throwaway certificate only
+    openssl req -x509 -newkey ec -pkeyopt ec_paramgen_curve:P-256 -nodes -days 1 -subj /CN=localhost \
+        -addext subjectAltName=IP:127.0.0.1 -keyout "$TLS_KEY" -out "$TLS_CERT" > /dev/null 2>&1 || exit 1
+    export CHAT_TLS_CA="$TLS_CERT"
+    SERVER_OPTS="-t $TLS_PORT -c $TLS_CERT -k $TLS_KEY"; BENCH_OPTS="-p $TLS_PORT -t" ;;
+shm) SERVER_OPTS="-u $LOCAL_PATH"; BENCH_OPTS="-u $LOCAL_PATH" ;;
+*) SERVER_OPTS=""; BENCH_OPTS="-p $PORT" ;;
+esac
+
+printf "\nBenchmarking batch windows ...\n"
+printf "==========================\n\n"
+make server bench > /dev/null || exit 1
+
+# "<window usec>:<max msgs>" pairs, the first one is batching off
+for BATCH in 0:1 0:16 100:16 1000:32 5000:64
+do
+    WINDOW=${BATCH%%:*}
+    MAX_MSGS=${BATCH##*:}
+    echo "--- batch window ${WINDOW} usec, max ${MAX_MSGS} msgs ---"
+
+    # no CLI on stdin, the server then runs until SIGTERM and shuts down like option 2
+    ./server -b "$WINDOW" -n "$MAX_MSGS" $SERVER_OPTS $PORT < /dev/null > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 0.5
+    ./bench $BENCH_OPTS -c "$CLIENTS" -m "$MESSAGES" -r "$RATE" -z "$CODEC" -s "$SIZE"
+    kill $SERVER_PID
+    wait $SERVER_PID
+    echo ""
+done
+
+echo "=========================="
+printf "Benchmark completed.\n\n"
+exit 0
@@ -0,0 +1,306 @@
+/***
+ * @file chat_proto.c
+ * @brief wire format shared by the chat server and client
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+/* HEADERS */
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+
+#include "chat_proto.h"
+
+/* FUNCTIONS */
+static ssize_t sock_recv_all(void *ctx, void *buf, size_t len);
+static void hex_encode(const uint8_t *bytes, size_t len, char *out);
+
+/* GLOBAL VARIABLES */
+static const char *g_codec_names[CODEC_COUNT] = {
+    [CODEC_LEGACY] = "legacy",
+    [CODEC_PLAIN] = "none",
+    [CODEC_DEFLATE] = "deflate",
+    [CODEC_WEBSOCKET] = "websocket"};
+
+/* Codec Functions */
+int codec_from_name(const char *name)
+{
+    for (int i = CODEC_PLAIN; i <= CODEC_DEFLATE; i++) // websocket 은 HTTP 업그레이드로만 정해진다
+    {
+        if (strcmp(name, g_codec_names[i]) == 0)
+            return i;
+    }
+    return CODEC_PLAIN; // 모르는 코덱을 요청하면 압축 없이 프레임만 사용
+}
+
+const char *codec_name(int codec)
+{
+    return (codec >= 0 && codec < CODEC_COUNT) ? g_codec_names[codec] : "unknown";
+}
+
+int handshake_parse(char *hello, int *codec) // "<nickname>[;<codec>]" 을 잘라서 hello 에는 닉네임만 남긴다
+{
+    char *sep = strchr(hello, HANDSHAKE_CODEC_SEP);
+
+    *codec = CODEC_LEGACY;
+    if (sep != NULL)
+    {
+        *sep = '\0';
+        if (strcmp(sep + 1, HANDSHAKE_PEER) == 0) // 피어 링크는 항상 deflate 프레임을 쓴다
+        {
+            *codec = CODEC_DEFLATE;
+            return (hello[0] == '\0') ? -1 : 1;
+        }
+        *codec = codec_from_name(sep + 1);
+    }
+    return (hello[0] == '\0') ? -1 : 0;
+}
+
+/* after "<node>;peer" the server sends a fresh nonce and the node answers with
+ * HMAC-SHA256(secret, "<nonce>;<node>"), so the secret itself never crosses the link */
+int handshake_peer_nonce(char *out, size_t out_size) // hex, -1 : no randomness
+{
+    uint8_t nonce[HANDSHAKE_NONCE_LEN];
+
+    if (out_size < HANDSHAKE_NONCE_LEN * 2 + 1 || RAND_bytes(nonce, sizeof(nonce)) != 1)
+        return -1;
+    hex_encode(nonce, sizeof(nonce), out);
+    return 0;
+}
+
+int handshake_peer_proof(const char *secret, const char *nonce, const char *node, char *out, size_t out_size) // hex, -1 : failed
+{
+    char msg[HANDSHAKE_BUF_SIZE * 2];
+    uint8_t mac[HANDSHAKE_PROOF_LEN];
+    unsigned int mac_len = 0;
+    int msg_len = snprintf(msg, sizeof(msg), "%s;%s", nonce, node);
+
+    if (out_size < HANDSHAKE_PROOF_LEN * 2 + 1 || msg_len < 0 || msg_len >= (int)sizeof(msg) ||
+        HMAC(EVP_sha256(), secret, strlen(secret), (const uint8_t *)msg, msg_len, mac, &mac_len) == NULL ||
+        mac_len != HANDSHAKE_PROOF_LEN)
+        return -1;
+    hex_encode(mac, mac_len, out);
+    return 0;
+}
+
+static void hex_encode(const uint8_t *bytes, size_t len, char *out) // out : 2 * len + 1
+{
+    static const char digits[] = "0123456789abcdef";
+
+    for (size_t i = 0; i < len; i++)
+    {
+        out[2 * i] = digits[bytes[i] >> 4];
+        out[2 * i + 1] = digits[bytes[i] & 0x0F];
+    }
+    out[2 * len] = '\0';
+}
+
+/* Frame Functions */
+void frame_pack_header(uint8_t *buf, const FrameHeader *hdr)
+{
+    uint32_t len = htonl(hdr->len);
+    uint16_t raw_len = htons(hdr->raw_len);
+    uint32_t seq = htonl(hdr->seq);
+
+    memcpy(buf, &len, 4);
+    memcpy(buf + 4, &raw_len, 2);
+    buf[6] = hdr->type;
+    buf[7] = hdr->codec;
+    memcpy(buf + 8, &seq, 4);
+}
+
+void frame_unpack_header(const uint8_t *buf, FrameHeader *hdr)
+{
+    uint32_t len;
+    uint16_t raw_len;
+    uint32_t seq;
+
+    memcpy(&len, buf, 4);
+    memcpy(&raw_len, buf + 4, 2);
+    memcpy(&seq, buf + 8, 4);
+    hdr->len = ntohl(len);
+    hdr->raw_len = ntohs(raw_len);
+    hdr->type = buf[6];
+    hdr->codec = buf[7];
+    hdr->seq = ntohl(seq);
+}
+
+/* builds one complete text frame into out, returns its total length or -1 */
+int frame_build(uint8_t *out, size_t out_size, uint8_t type, uint32_t seq, int codec, z_stream *zs, const char *msg, size_t msg_len)
+{
+    FrameHeader hdr = {.len = msg_len, .raw_len = msg_len, .type = type, .codec = FRAME_CODEC_NONE, .seq = seq};
+
+    if (msg_len > MESSAGE_MAX_LEN || out_size < FRAME_HEADER_SIZE + msg_len)
+        return -1;
+
+    if (codec == CODEC_DEFLATE && zs != NULL && msg_len >= COMPRESS_MIN_LEN)
+    {
+        deflateReset(zs);
+        zs->next_in = (Bytef *)msg;
+        zs->avail_in = msg_len;
+        zs->next_out = out + FRAME_HEADER_SIZE;
+        zs->avail_out = out_size - FRAME_HEADER_SIZE;
+
+        // 압축 결과가 원문보다 작을 때만 압축본을 사용
+        if (deflate(zs, Z_FINISH) == Z_STREAM_END && zs->total_out < msg_len)
+        {
+            hdr.len = zs->total_out;
+            hdr.codec = FRAME_CODEC_DEFLATE;
+        }
+    }
+
+    if (hdr.codec == FRAME_CODEC_NONE)
+        memcpy(out + FRAME_HEADER_SIZE, msg, msg_len);
+
+    frame_pack_header(out, &hdr);
+    return FRAME_HEADER_SIZE + hdr.len;
+}
+
+int frame_build_resend(uint8_t *out, size_t out_size, uint32_t from, uint32_t to)
+{
+    FrameHeader hdr = {.len = 8, .raw_len = 8, .type = FRAME_RESEND, .codec = FRAME_CODEC_NONE};
+    uint32_t range[2] = {htonl(from), htonl(to)};
+
+    if (out_size < FRAME_HEADER_SIZE + sizeof(range))
+        return -1;
+    frame_pack_header(out, &hdr);
+    memcpy(out + FRAME_HEADER_SIZE, range, sizeof(range));
+    return FRAME_HEADER_SIZE + sizeof(range);
+}
+
+int frame_parse_resend(const FrameHeader *hdr, const uint8_t *payload, uint32_t *from, uint32_t *to)
+{
+    uint32_t range[2];
+
+    if (hdr->type != FRAME_RESEND || hdr->len != sizeof(range))
+        return -1;
+    memcpy(range, payload, sizeof(range));
+    *from = ntohl(range[0]);
+    *to = ntohl(range[1]);
+    return (*from <= *to) ? 0 : -1;
+}
+
+int frame_build_members(uint8_t *out, size_t out_size, uint32_t members)
+{
+    FrameHeader hdr = {.len = 4, .raw_len = 4, .type = FRAME_PEER_MEMBERS, .codec = FRAME_CODEC_NONE};
+    uint32_t count = htonl(members);
+
+    if (out_size < FRAME_HEADER_SIZE + sizeof(count))
+        return -1;
+    frame_pack_header(out, &hdr);
+    memcpy(out + FRAME_HEADER_SIZE, &count, sizeof(count));
+    return FRAME_HEADER_SIZE + sizeof(count);
+}
+
+int frame_parse_members(const FrameHeader *hdr, const uint8_t *payload, uint32_t *members)
+{
+    uint32_t count;
+
+    if (hdr->type != FRAME_PEER_MEMBERS || hdr->len != sizeof(count))
+        return -1;
+    memcpy(&count, payload, sizeof(count));
+    *members = ntohl(count);
+    return 0;
+}
+
+/* reads exactly one frame from sockfd, returns 1 on success, 0 on close, -1 on error */
+int frame_read(int sockfd, FrameHeader *hdr, uint8_t *payload, size_t payload_size)
+{
+    return frame_read_from(sock_recv_all, &sockfd, hdr, payload, payload_size);
+}
+
+int frame_read_from(RecvAllFn recv_fn, void *ctx, FrameHeader *hdr, uint8_t *payload, size_t payload_size)
+{
+    uint8_t head[FRAME_HEADER_SIZE];
+    ssize_t n;
+
+    *hdr = (FrameHeader){0}; // set on every path, LTO builds cannot tell callers only read it on success
+    if ((n = recv_fn(ctx, head, sizeof(head))) <= 0)
+        return n;
+
+    frame_unpack_header(head, hdr);
+    if (hdr->len > payload_size)
+        return -1;
+
+    if (hdr->len > 0 && (n = recv_fn(ctx, payload, hdr->len)) <= 0)
+        return n;
+    return 1;
+}
+
+static ssize_t sock_recv_all(void *ctx, void *buf, size_t len)
+{
+    return recv_all(*(int *)ctx, buf, len);
+}
+
+/* turns a received payload back into NUL terminated text, returns its length or -1 */
+int frame_decode(const FrameHeader *hdr, z_stream *zs, const uint8_t *payload, char *out, size_t out_size)
+{
+    if (hdr->raw_len >= out_size)
+        return -1;
+
+    switch (hdr->codec)
+    {
+    case FRAME_CODEC_NONE:
+        if (hdr->len != hdr->raw_len)
+            return -1;
+        memcpy(out, payload, hdr->len);
+        out[hdr->len] = '\0';
+        return hdr->len;
+
+    case FRAME_CODEC_DEFLATE:
+        if (zs == NULL)
+            return -1;
+        inflateReset(zs);
+        zs->next_in = (Bytef *)payload;
+        zs->avail_in = hdr->len;
+        zs->next_out = (Bytef *)out;
+        zs->avail_out = out_size - 1;
+        if (inflate(zs, Z_FINISH) != Z_STREAM_END || zs->total_out != hdr->raw_len)
+            return -1;
+        out[hdr->raw_len] = '\0';
+        return hdr->raw_len;
+
+    default:
+        return -1;
+    }
+}
+
+/* Socket Functions */
+ssize_t send_all(int sockfd, const void *buf, size_t len)
+{
+    size_t sent = 0;
+
+    while (sent < len)
+    {
+        ssize_t n = send(sockfd, (const char *)buf + sent, len - sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        sent += n;
+    }
+    return sent;
+}
+
+ssize_t recv_all(int sockfd, void *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len)
+    {
+        ssize_t n = recv(sockfd, (char *)buf + got, len - got, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return n;
+        got += n;
+    }
+    return got;
+}
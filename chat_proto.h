@@ -0,0 +1,88 @@
+/***
+ * @file chat_proto.h
+ * @brief wire format shared by the chat server and client
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+#ifndef CHAT_PROTO_H
+#define CHAT_PROTO_H
+
+/* HEADERS */
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <zlib.h>
+
+/* DEFINE */
+#define HANDSHAKE_BUF_SIZE 64
+#define HANDSHAKE_CODEC_SEP ';'  /* "<nickname>;<codec>" */
+#define HANDSHAKE_PEER "peer"    /* "<node>;peer" : server to server link instead of a chatter */
+#define HANDSHAKE_NONCE_LEN 16   /* random bytes the server challenges a node with, sent as hex */
+#define HANDSHAKE_PROOF_LEN 32   /* HMAC-SHA256 of the node's answer, sent as hex */
+#define MESSAGE_MAX_LEN 1044     /* "(USER NAME : %s) " + data */
+#define FRAME_HEADER_SIZE 12
+#define FRAME_MAX_PAYLOAD (MESSAGE_MAX_LEN + 64) /* deflate may grow incompressible input a little */
+#define FRAME_MAX_SIZE (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD)
+#define COMPRESS_MIN_LEN 128     /* smaller messages are always sent uncompressed */
+
+/* connection codecs, negotiated once at the nickname handshake */
+enum
+{
+    CODEC_LEGACY = 0,  /* no codec requested : unframed text (nc, old clients) */
+    CODEC_PLAIN = 1,   /* framed, never compressed */
+    CODEC_DEFLATE = 2, /* framed, zlib compressed above COMPRESS_MIN_LEN */
+    CODEC_WEBSOCKET,   /* RFC 6455 text frames, set by the HTTP upgrade, never negotiated */
+    CODEC_COUNT
+};
+
+/* codec byte carried in each frame header */
+enum
+{
+    FRAME_CODEC_NONE = 0,
+    FRAME_CODEC_DEFLATE = 1
+};
+
+enum
+{
+    FRAME_CHAT = 1,   /* live broadcast, seq is the room sequence number */
+    FRAME_REPLAY = 2, /* re-sent from history after a FRAME_RESEND, seq as originally stamped */
+    FRAME_RESEND = 3, /* client -> server, payload is the missing [from, to] seq range */
+    FRAME_PEER_MSG = 4,    /* node -> node, payload is "<nickname>\0<text>" of a locally received message */
+    FRAME_PEER_MEMBERS = 5 /* node -> node, payload is the sender's local client count */
+};
+
+/* STRUCTS */
+typedef struct
+{
+    uint32_t len;     /* payload bytes following the header */
+    uint16_t raw_len; /* payload bytes after decompression */
+    uint8_t type;
+    uint8_t codec;
+    uint32_t seq;     /* room sequence number, 0 : none */
+} FrameHeader;
+
+typedef ssize_t (*RecvAllFn)(void *ctx, void *buf, size_t len); // recv_all() of some transport
+
+/* FUNCTIONS */
+int codec_from_name(const char *name);
+const char *codec_name(int codec);
+int handshake_parse(char *hello, int *codec); // 1 : peer node, 0 : chatter, -1 : empty nickname
+int handshake_peer_nonce(char *out, size_t out_size);
+int handshake_peer_proof(const char *secret, const char *nonce, const char *node, char *out, size_t out_size);
+
+void frame_pack_header(uint8_t *buf, const FrameHeader *hdr);
+void frame_unpack_header(const uint8_t *buf, FrameHeader *hdr);
+int frame_build(uint8_t *out, size_t out_size, uint8_t type, uint32_t seq, int codec, z_stream *zs, const char *msg, size_t msg_len);
+int frame_build_resend(uint8_t *out, size_t out_size, uint32_t from, uint32_t to);
+int frame_parse_resend(const FrameHeader *hdr, const uint8_t *payload, uint32_t *from, uint32_t *to);
+int frame_build_members(uint8_t *out, size_t out_size, uint32_t members);
+int frame_parse_members(const FrameHeader *hdr, const uint8_t *payload, uint32_t *members);
+int frame_read(int sockfd, FrameHeader *hdr, uint8_t *payload, size_t payload_size);
+int frame_read_from(RecvAllFn recv_fn, void *ctx, FrameHeader *hdr, uint8_t *payload, size_t payload_size);
+int frame_decode(const FrameHeader *hdr, z_stream *zs, const uint8_t *payload, char *out, size_t out_size);
+
+ssize_t send_all(int sockfd, const void *buf, size_t len);
+ssize_t recv_all(int sockfd, void *buf, size_t len);
+
+#endif
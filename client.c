@@ -12,45 +12,121 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <signal.h>
 #include <time.h>
 
+#include "chat_proto.h"
+#include "conn.h"
+
 /* DEFINE */
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 9999
+#define TLS_PORT_PREFIX "tls:" /* "tls:<Port>" : TLS to the server's -t port */
+#define TLS_CA_ENV "CHAT_TLS_CA" /* CA file to verify the server with, unset : the system CA store */
 
 /* FUNCTIONS */
+static ssize_t tcp_connect(Conn *conn, uint16_t port, SSL_CTX *tls_ctx, char *welcome, size_t welcome_size);
 void *th_receiver(void *arg);
 void *th_sender(void *arg);
 
 /* GLOBAL VARIABLES */
 int g_socket_stat = 0;
+int g_codec = CODEC_DEFLATE;
 time_t g_current_time;
 pthread_mutex_t g_sync_mut;
+pthread_mutex_t g_send_mut; // th_sender 와 th_receiver(FRAME_RESEND) 가 프레임을 섞어 쓰지 않도록
 
 /* MAIN */
 int main(int argc, char *argv[])
 {
-    int client_sockfd;
+    Conn conn;
     char tmp_recv_buf[1024];
-    struct sockaddr_in server_address;
-    struct sockaddr_in client_address;
-    socklen_t client_address_len = sizeof(client_address);
-    size_t bytes_received;
-    uint16_t port;
+    char hello[HANDSHAKE_BUF_SIZE];
+    ssize_t bytes_received;
+    uint16_t port = SERVER_PORT;
+    const char *local_path = NULL; // "<Port>" 자리에 경로를 주면 같은 호스트의 공유 메모리로 접속
+    const char *port_arg = (argc > 2) ? argv[2] : NULL;
+    SSL_CTX *tls_ctx = NULL;
 
+    signal(SIGPIPE, SIG_IGN); // OpenSSL writes with write(2), a vanished server must be an error and not a signal
     pthread_mutex_init(&g_sync_mut, NULL);
+    pthread_mutex_init(&g_send_mut, NULL);
     if (argc < 2)
     {
-        fprintf(stdout, "[CLIENT] Usage: %s <Chatter Name> <Port>\n", argv[0]);
+        fprintf(stdout, "[CLIENT] Usage: %s <Chatter Name> <Port | tls:Port | Local Socket Path> [none|deflate]\n", argv[0]);
         exit(EXIT_FAILURE);
     }
-    if ((port = ((argc > 2) ? atoi(argv[2]) : SERVER_PORT)) <= 0)
+    if (port_arg != NULL && strncmp(port_arg, TLS_PORT_PREFIX, strlen(TLS_PORT_PREFIX)) == 0)
+    {
+        port_arg += strlen(TLS_PORT_PREFIX);
+        if ((tls_ctx = tls_client_ctx(getenv(TLS_CA_ENV))) == NULL)
+        {
+            fprintf(stdout, "[CLIENT] TLS setup failed, check %s\n", TLS_CA_ENV);
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (port_arg != NULL && strchr(port_arg, '/') != NULL)
+        local_path = port_arg;
+    else if ((port = ((port_arg != NULL) ? atoi(port_arg) : SERVER_PORT)) <= 0)
     {
         fprintf(stdout, "[SERVER] bad port number %s/n", argv[1]);
         exit(EXIT_FAILURE);
     }
+    if (argc > 3)
+    {
+        g_codec = codec_from_name(argv[3]);
+    }
     fprintf(stdout, "[CLIENT] Chat Client Program Exectued.\n");
 
+    if (local_path != NULL) // unix socket handshake, then every frame goes through shared memory
+    {
+        if ((bytes_received = conn_local_connect(&conn, local_path, tmp_recv_buf, sizeof(tmp_recv_buf) - 1)) > 0)
+            fprintf(stdout, "[CLIENT] Connected to server through shared memory (%s)\n\n", local_path);
+    }
+    else
+    {
+        bytes_received = tcp_connect(&conn, port, tls_ctx, tmp_recv_buf, sizeof(tmp_recv_buf) - 1);
+    }
+    if (bytes_received <= 0) // 서버가 종료되었거나, 접속자 수가 많아 접속이 불가능한 경우
+    {
+        fprintf(stdout, "[CLIENT] Chat Server is not available\n");
+        exit(EXIT_FAILURE);
+    }
+
+    snprintf(hello, sizeof(hello), "%s%c%s", argv[1], HANDSHAKE_CODEC_SEP, codec_name(g_codec)); // 닉네임과 함께 코덱을 협상
+    conn_hello_send(&conn, hello, strlen(hello)); // 로컬 접속도 핸드셰이크는 유닉스 소켓으로
+    tmp_recv_buf[bytes_received] = '\0';
+    fprintf(stdout, "[CLIENT] Received: %s\n", tmp_recv_buf);
+    fprintf(stdout, "[CLIENT] Logined to %s. Chatroom is ready. You can chat now!\n", argv[1]);
+    fprintf(stdout, "[CLIENT] Message codec : %s\n", codec_name(g_codec));
+
+    // 쓰레드 생성
+    pthread_t receiver_tid, sender_tid;
+    pthread_create(&receiver_tid, NULL, th_receiver, (void *)&conn);
+    pthread_create(&sender_tid, NULL, th_sender, (void *)&conn);
+
+    // 쓰레드 종료 대기
+    pthread_join(receiver_tid, NULL);
+    sleep(1);
+    pthread_cancel(sender_tid);
+    pthread_join(sender_tid, NULL);
+
+    pthread_mutex_destroy(&g_sync_mut);
+    pthread_mutex_destroy(&g_send_mut);
+    conn_close(&conn);
+    SSL_CTX_free(tls_ctx);
+    return 0;
+}
+
+/* connects over TCP (TLS with tls_ctx) and reads the welcome message, returns its length, <= 0 when the server is not available */
+static ssize_t tcp_connect(Conn *conn, uint16_t port, SSL_CTX *tls_ctx, char *welcome, size_t welcome_size)
+{
+    int client_sockfd;
+    struct sockaddr_in server_address;
+    struct sockaddr_in client_address;
+    socklen_t client_address_len = sizeof(client_address);
+    ssize_t bytes_received;
+
     /* setup socket settings */
     client_sockfd = socket(AF_INET, SOCK_STREAM, 0);
     server_address.sin_family = AF_INET;                       // IPv4
@@ -81,40 +157,29 @@ int main(int argc, char *argv[])
             - Client Port : %d\n\n",
             inet_ntoa(client_address.sin_addr), ntohs(client_address.sin_port));
 
-    bytes_received = recv(client_sockfd, tmp_recv_buf, sizeof(tmp_recv_buf), 0);
-    if (bytes_received <= 0) // 서버가 종료되었거나, 접속자 수가 많아 접속이 불가능한 경우
+    if (tls_ctx == NULL)
+        conn_tcp(conn, client_sockfd);
+    else if (conn_tls(conn, client_sockfd, tls_ctx, SERVER_IP) < 0)
     {
-        fprintf(stdout, "[CLIENT] Chat Server is not available\n");
+        fprintf(stdout, "[CLIENT] TLS handshake failed, is the server certificate for %s trusted (%s) ?\n", SERVER_IP, TLS_CA_ENV);
         close(client_sockfd);
-        exit(EXIT_FAILURE);
+        return -1;
     }
+    else
+        fprintf(stdout, "[CLIENT] TLS session, records : %s\n", tls_records_name(conn->ssl));
 
-    send(client_sockfd, argv[1], strlen(argv[1]), 0);
-    tmp_recv_buf[bytes_received] = '\0';
-    fprintf(stdout, "[CLIENT] Received: %s\n", tmp_recv_buf);
-    fprintf(stdout, "[CLIENT] Logined to %s. Chatroom is ready. You can chat now!\n", argv[1]);
-
-    // 쓰레드 생성
-    pthread_t receiver_tid, sender_tid;
-    pthread_create(&receiver_tid, NULL, th_receiver, (void *)&client_sockfd);
-    pthread_create(&sender_tid, NULL, th_sender, (void *)&client_sockfd);
-
-    // 쓰레드 종료 대기
-    pthread_join(receiver_tid, NULL);
-    sleep(1);
-    pthread_cancel(sender_tid);
-    pthread_join(sender_tid, NULL);
-
-    pthread_mutex_destroy(&g_sync_mut);
-    close(client_sockfd);
-    return 0;
+    bytes_received = conn_hello_recv(conn, welcome, welcome_size);
+    if (bytes_received <= 0)
+        conn_close(conn);
+    return bytes_received;
 }
 
 void *th_sender(void *arg)
 {
     int status = 0;
-    int client_sockfd = *(int *)arg;
+    Conn *conn = (Conn *)arg;
     char user_input[1024];
+    uint8_t frame[FRAME_MAX_SIZE];
     size_t user_input_len = 0;
     fprintf(stdout, "[CLIENT] Enter message to send (type 'exit' to quit): \n");
     while (1)
@@ -141,7 +206,9 @@ void *th_sender(void *arg)
         if (status == -1)
             break;
 
-        send(client_sockfd, user_input, sizeof(user_input), 0);
+        pthread_mutex_lock(&g_send_mut);
+        conn_send_all(conn, frame, frame_build(frame, sizeof(frame), FRAME_CHAT, 0, CODEC_PLAIN, NULL, user_input, user_input_len));
+        pthread_mutex_unlock(&g_send_mut);
 
         if (strcmp(user_input, "exit") == 0)
         {
@@ -162,13 +229,24 @@ void *th_sender(void *arg)
 void *th_receiver(void *arg)
 {
     int status = 0;
-    int client_sockfd = *(int *)arg;
-    char recv_buffer[1024];
-    size_t bytes_received;
+    Conn *conn = (Conn *)arg;
+    char recv_buffer[MESSAGE_MAX_LEN + 1];
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint8_t resend[FRAME_HEADER_SIZE + 8];
+    FrameHeader hdr;
+    z_stream inflate_stream = {0};
+    uint32_t last_seq = 0; // 마지막으로 받은 room seq, 0 : 아직 없음
+    int bytes_received;
 
-    while (1)
+    if (inflateInit(&inflate_stream) != Z_OK)
+    {
+        fprintf(stdout, "[CLIENT] inflateInit failed\n");
+        status = -1;
+    }
+
+    while (status == 0)
     {
-        bytes_received = recv(client_sockfd, recv_buffer, sizeof(recv_buffer), 0);
+        bytes_received = conn_frame_read(conn, &hdr, payload, sizeof(payload));
         if (bytes_received < 0)
         {
             fprintf(stdout, "[CLIENT] Error occued during receiving data\n");
@@ -179,6 +257,11 @@ void *th_receiver(void *arg)
             fprintf(stdout, "[CLIENT] Socket closed. ...\n");
             status = -1;
         }
+        else if (frame_decode(&hdr, &inflate_stream, payload, recv_buffer, sizeof(recv_buffer)) < 0)
+        {
+            fprintf(stdout, "[CLIENT] Malformed frame dropped\n");
+            continue;
+        }
 
         pthread_mutex_lock(&g_sync_mut);
         g_socket_stat = status;
@@ -186,14 +269,27 @@ void *th_receiver(void *arg)
         if (status == -1)
             break;
 
-        recv_buffer[bytes_received] = '\0';
+        if (hdr.type == FRAME_CHAT && hdr.seq != 0)
+        {
+            if (last_seq != 0 && hdr.seq > last_seq + 1) // 서버가 drop-oldest 로 버린 구간을 다시 요청
+            {
+                fprintf(stdout, "[CLIENT] Missed messages %u ~ %u, requesting resend\n", last_seq + 1, hdr.seq - 1);
+                pthread_mutex_lock(&g_send_mut);
+                conn_send_all(conn, resend, frame_build_resend(resend, sizeof(resend), last_seq + 1, hdr.seq - 1));
+                pthread_mutex_unlock(&g_send_mut);
+            }
+            if (hdr.seq > last_seq)
+                last_seq = hdr.seq;
+        }
+
         time(&g_current_time);
         fprintf(stdout, "[CLIENT]\n\
             [TIME] %s\
-            [Received Data]\n\
+            [%s Data #%u]\n\
             %s\n",
-                ctime(&g_current_time), recv_buffer);
+                ctime(&g_current_time), (hdr.type == FRAME_REPLAY) ? "Replayed" : "Received", hdr.seq, recv_buffer);
     }
 
+    inflateEnd(&inflate_stream);
     pthread_exit((void *)&status);
 }
\ No newline at end of file
@@ -0,0 +1,314 @@
+/***
+ * @file conn.c
+ * @brief one chat connection, either a TCP stream or a pair of shared memory rings
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ *
+ * A local client connects to the server's unix socket. The server answers
+ * with the usual welcome message and passes a memfd holding two rings plus
+ * their eventfds (SCM_RIGHTS). After the nickname handshake every frame
+ * goes through the rings; the socket stays open only so that either side
+ * notices when the other one is gone.
+ * Every TLS record goes through OpenSSL, in user space or in the kernel
+ * when OpenSSL could hand it over (see tls.c), on a non-blocking socket,
+ * one SSL call at a time under ssl_mut, so the receiver never holds the
+ * lock while it waits for data.
+ */
+
+/* HEADERS */
+#define _GNU_SOURCE /* memfd_create */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <sys/eventfd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "conn.h"
+
+/* FUNCTIONS */
+static ssize_t conn_recv_all_fn(void *ctx, void *buf, size_t len);
+static void conn_shm_attach(Conn *conn, int sockfd, ShmRingShared *map, const int *efds, int is_server);
+static ssize_t conn_ssl_io(Conn *conn, void *buf, size_t len, int is_write);
+
+/* Setup Functions */
+void conn_tcp(Conn *conn, int sockfd)
+{
+    *conn = (Conn){.type = CONN_TCP, .sockfd = sockfd, .timeout_ms = -1};
+}
+
+int conn_local_listen(const char *path) // returns the listening unix socket or -1
+{
+    int sockfd;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+
+    if (strlen(path) >= sizeof(address.sun_path) || (sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    unlink(path); // a stale socket file from an earlier run
+    if (bind(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(sockfd, SOMAXCONN) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/* server side of an accepted unix socket : creates the rings and sends them with the welcome message */
+int conn_local_serve(Conn *conn, int sockfd, const char *welcome, size_t welcome_len)
+{
+    int fds[CONN_SHM_FDS] = {-1, -1, -1, -1, -1};
+    size_t map_len = 2 * sizeof(ShmRingShared);
+    ShmRingShared *map = MAP_FAILED;
+    struct iovec iov = {.iov_base = (void *)welcome, .iov_len = welcome_len};
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+
+    if ((fds[0] = memfd_create("chat-conn", MFD_CLOEXEC)) < 0 || ftruncate(fds[0], map_len) < 0 ||
+        (map = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0)) == MAP_FAILED)
+        goto fail;
+    for (int i = 1; i < CONN_SHM_FDS; i++)
+    {
+        if ((fds[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) < 0)
+            goto fail;
+    }
+    shm_ring_init(&map[0]);
+    shm_ring_init(&map[1]);
+
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+    if (sendmsg(sockfd, &msg, MSG_NOSIGNAL) < 0)
+        goto fail;
+
+    close(fds[0]); // the mapping stays
+    conn_shm_attach(conn, sockfd, map, fds, 1);
+    return 0;
+
+fail:
+    if (map != MAP_FAILED)
+        munmap(map, map_len);
+    for (int i = 0; i < CONN_SHM_FDS; i++)
+    {
+        if (fds[i] >= 0)
+            close(fds[i]);
+    }
+    return -1;
+}
+
+/* client side : connects to the server's unix socket, returns the welcome message length or -1 */
+int conn_local_connect(Conn *conn, const char *path, char *welcome, size_t welcome_size)
+{
+    int sockfd, fds[CONN_SHM_FDS];
+    ssize_t n;
+    ShmRingShared *map;
+    struct sockaddr_un address = {.sun_family = AF_UNIX};
+    struct iovec iov = {.iov_base = welcome, .iov_len = welcome_size};
+    union
+    {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } control;
+    struct msghdr msg = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buf, .msg_controllen = sizeof(control.buf)};
+    struct cmsghdr *cmsg;
+
+    if (strlen(path) >= sizeof(address.sun_path) || (sockfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+    if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        (n = recvmsg(sockfd, &msg, MSG_CMSG_CLOEXEC)) <= 0 || // nothing if the server is full
+        (cmsg = CMSG_FIRSTHDR(&msg)) == NULL || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(fds)))
+    {
+        close(sockfd);
+        return -1;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    map = mmap(NULL, 2 * sizeof(ShmRingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fds[0], 0);
+    close(fds[0]);
+    if (map == MAP_FAILED)
+    {
+        for (int i = 1; i < CONN_SHM_FDS; i++)
+        {
+            close(fds[i]);
+        }
+        close(sockfd);
+        return -1;
+    }
+    conn_shm_attach(conn, sockfd, map, fds, 0);
+    return n;
+}
+
+static void conn_shm_attach(Conn *conn, int sockfd, ShmRingShared *map, const int *efds, int is_server)
+{
+    ShmRing down = {.shared = &map[0], .data_efd = efds[1], .space_efd = efds[2], .hup_fd = sockfd};
+    ShmRing up = {.shared = &map[1], .data_efd = efds[3], .space_efd = efds[4], .hup_fd = sockfd};
+
+    *conn = (Conn){.type = CONN_SHM, .sockfd = sockfd, .timeout_ms = -1, .map = map};
+    conn->tx = is_server ? down : up;
+    conn->rx = is_server ? up : down;
+}
+
+/* TLS handshake on a connected TCP socket, host NULL : server side, returns 0 or -1 (sockfd is left open) */
+int conn_tls(Conn *conn, int sockfd, SSL_CTX *ctx, const char *host)
+{
+    SSL *ssl;
+
+    if (tls_start(ctx, sockfd, host, &ssl) == TLS_START_FAILED)
+        return -1;
+    conn_tcp(conn, sockfd);
+    conn->type = CONN_TLS;
+    conn->ssl = ssl;
+    pthread_mutex_init(&conn->ssl_mut, NULL);
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL) | O_NONBLOCK);
+    return 0;
+}
+
+void conn_set_timeout(Conn *conn, int timeout_ms)
+{
+    struct timeval tv = {.tv_sec = timeout_ms / 1000, .tv_usec = (timeout_ms % 1000) * 1000};
+
+    conn->timeout_ms = timeout_ms;
+    if (conn->type == CONN_TCP)
+        setsockopt(conn->sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+
+/* I/O Functions */
+ssize_t conn_hello_send(Conn *conn, const void *buf, size_t len) // welcome / nickname, over the socket even for SHM
+{
+    if (conn->type == CONN_TLS)
+        return conn_ssl_io(conn, (void *)buf, len, 1);
+    return send(conn->sockfd, buf, len, MSG_NOSIGNAL);
+}
+
+ssize_t conn_hello_recv(Conn *conn, void *buf, size_t size)
+{
+    if (conn->type == CONN_TLS)
+        return conn_ssl_io(conn, buf, size, 0);
+    return recv(conn->sockfd, buf, size, 0);
+}
+
+ssize_t conn_send_all(Conn *conn, const void *buf, size_t len)
+{
+    if (conn->type == CONN_SHM)
+        return shm_ring_write(&conn->tx, buf, len);
+    if (conn->type == CONN_TLS)
+    {
+        for (size_t sent = 0; sent < len;)
+        {
+            ssize_t n = conn_ssl_io(conn, (char *)buf + sent, len - sent, 1);
+            if (n <= 0)
+                return -1;
+            sent += n;
+        }
+        return len;
+    }
+    return send_all(conn->sockfd, buf, len);
+}
+
+ssize_t conn_recv(Conn *conn, void *buf, size_t len) // like recv(2) : some bytes, 0 on close, -1 on error
+{
+    if (conn->type == CONN_SHM)
+        return shm_ring_read(&conn->rx, buf, len, conn->timeout_ms);
+    if (conn->type == CONN_TLS)
+        return conn_ssl_io(conn, buf, len, 0);
+    return recv(conn->sockfd, buf, len, 0);
+}
+
+ssize_t conn_recv_all(Conn *conn, void *buf, size_t len)
+{
+    size_t got = 0;
+
+    if (conn->type == CONN_TCP)
+        return recv_all(conn->sockfd, buf, len);
+    while (got < len)
+    {
+        ssize_t n = conn_recv(conn, (char *)buf + got, len - got);
+        if (n <= 0)
+            return n;
+        got += n;
+    }
+    return got;
+}
+
+/* one SSL_read / SSL_write, polling the socket while OpenSSL wants more, returns like recv(2) / send(2) */
+static ssize_t conn_ssl_io(Conn *conn, void *buf, size_t len, int is_write)
+{
+    struct pollfd pfd = {.fd = conn->sockfd};
+    int n, err;
+
+    while (1)
+    {
+        pthread_mutex_lock(&conn->ssl_mut);
+        n = is_write ? SSL_write(conn->ssl, buf, len) : SSL_read(conn->ssl, buf, len);
+        err = SSL_get_error(conn->ssl, n);
+        pthread_mutex_unlock(&conn->ssl_mut);
+        if (n > 0)
+            return n;
+        if (err == SSL_ERROR_ZERO_RETURN)
+            return 0;
+        if (err != SSL_ERROR_WANT_READ && err != SSL_ERROR_WANT_WRITE)
+        {
+            errno = ECONNRESET;
+            return -1;
+        }
+        pfd.events = (err == SSL_ERROR_WANT_READ) ? POLLIN : POLLOUT;
+        if ((n = poll(&pfd, 1, is_write ? -1 : conn->timeout_ms)) == 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (n < 0 && errno != EINTR)
+            return -1;
+    }
+}
+
+int conn_frame_read(Conn *conn, FrameHeader *hdr, uint8_t *payload, size_t payload_size)
+{
+    return frame_read_from(conn_recv_all_fn, conn, hdr, payload, payload_size);
+}
+
+static ssize_t conn_recv_all_fn(void *ctx, void *buf, size_t len)
+{
+    return conn_recv_all((Conn *)ctx, buf, len);
+}
+
+void conn_shutdown(Conn *conn, int how) // SHUT_RD / SHUT_RDWR as in shutdown(2), wakes a blocked reader
+{
+    if (conn->type == CONN_SHM)
+    {
+        shm_ring_close(&conn->rx);
+        if (how == SHUT_RD)
+            return;
+        shm_ring_close(&conn->tx);
+    }
+    shutdown(conn->sockfd, how);
+}
+
+void conn_close(Conn *conn)
+{
+    if (conn->type == CONN_TLS)
+    {
+        SSL_shutdown(conn->ssl); // close_notify, best effort on the non-blocking socket
+        SSL_free(conn->ssl);
+        pthread_mutex_destroy(&conn->ssl_mut);
+    }
+    if (conn->type == CONN_SHM)
+    {
+        close(conn->tx.data_efd);
+        close(conn->tx.space_efd);
+        close(conn->rx.data_efd);
+        close(conn->rx.space_efd);
+        munmap(conn->map, 2 * sizeof(ShmRingShared));
+    }
+    close(conn->sockfd);
+}
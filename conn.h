@@ -0,0 +1,60 @@
+/***
+ * @file conn.h
+ * @brief one chat connection, either a TCP stream or a pair of shared memory rings
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+#ifndef CONN_H
+#define CONN_H
+
+/* HEADERS */
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "chat_proto.h"
+#include "shm_ring.h"
+#include "tls.h"
+
+/* DEFINE */
+#define CONN_SHM_FDS 5 /* memfd, then data / space eventfds of the server -> client and client -> server rings */
+
+enum
+{
+    CONN_TCP = 0,
+    CONN_SHM = 1, /* same host : unix socket handshake, then rings in a memfd both ways */
+    CONN_TLS = 2  /* TLS through OpenSSL, records in user space or in the kernel (tls_kernel_records()) */
+};
+
+/* STRUCTS */
+typedef struct
+{
+    int type;            // CONN_TCP, CONN_SHM, CONN_TLS
+    int sockfd;          // TCP : the stream, SHM : the handshake socket, kept open to notice hangups
+    int timeout_ms;      // receive timeout, -1 : none
+    ShmRing tx, rx;      // SHM only
+    ShmRingShared *map;  // SHM only, [0] server -> client, [1] client -> server
+    SSL *ssl;            // TLS only, the socket is non-blocking
+    pthread_mutex_t ssl_mut; // TLS only, a receiver and a writer thread share the SSL
+} Conn;
+
+/* FUNCTIONS */
+void conn_tcp(Conn *conn, int sockfd);
+int conn_local_listen(const char *path);
+int conn_local_serve(Conn *conn, int sockfd, const char *welcome, size_t welcome_len);
+int conn_local_connect(Conn *conn, const char *path, char *welcome, size_t welcome_size);
+int conn_tls(Conn *conn, int sockfd, SSL_CTX *ctx, const char *host);
+void conn_set_timeout(Conn *conn, int timeout_ms);
+
+ssize_t conn_hello_send(Conn *conn, const void *buf, size_t len);
+ssize_t conn_hello_recv(Conn *conn, void *buf, size_t size);
+ssize_t conn_send_all(Conn *conn, const void *buf, size_t len);
+ssize_t conn_recv(Conn *conn, void *buf, size_t len);
+ssize_t conn_recv_all(Conn *conn, void *buf, size_t len);
+int conn_frame_read(Conn *conn, FrameHeader *hdr, uint8_t *payload, size_t payload_size);
+void conn_shutdown(Conn *conn, int how);
+void conn_close(Conn *conn);
+
+#endif
@@ -0,0 +1,711 @@
+/***
+ * @file ingest.c
+ * @brief ingest stage of the receivers : UTF-8 validation, control character stripping, banned-term censoring
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ *
+ * Every chat message a receiver reads goes through a short pipeline of
+ * stages before it is published :
+ *
+ *   utf8      drops messages that are not valid UTF-8
+ *   controls  strips C0 control characters and DEL ("exit\r\n" from nc is "exit")
+ *   command   turns "exit" into INGEST_EXIT
+ *   terms     overwrites banned terms with INGEST_CENSOR
+ *
+ * and whatever ingest_stage_add() appended. Nicknames get the same
+ * checks except the command, see ingest_nickname(). The UTF-8 check is the
+ * lookup-table algorithm of Keiser & Lemire : three 16-entry tables indexed
+ * by nibbles of each byte and the byte before it flag every invalid pair,
+ * 32 bytes per step on AVX2 and 16 on SSSE3, pure ASCII blocks skip it.
+ * Banned terms are compiled into a complete Aho-Corasick automaton, one
+ * table load per input byte, and swapped in whole on reload so receivers
+ * never take a lock. A scan announces itself in one of two reader counters
+ * picked by the epoch parity; a reload swaps the set, then flips the epoch
+ * and waits for the counter it left behind to drain, twice, so every scan
+ * that could still hold the old set is gone before it is freed.
+ */
+
+/* HEADERS */
+#define _GNU_SOURCE /* getline */
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define INGEST_X86 1
+#endif
+
+#include "ingest.h"
+
+/* DEFINE */
+/* UTF-8 error classes of the lookup tables, a byte pair is invalid when all three tables agree on a bit */
+#define U8_TOO_SHORT 0x01  /* lead byte not followed by a continuation */
+#define U8_TOO_LONG 0x02   /* continuation after ASCII */
+#define U8_OVERLONG_3 0x04 /* E0 80..9F */
+#define U8_TOO_LARGE 0x08  /* above U+10FFFF */
+#define U8_SURROGATE 0x10  /* ED A0..BF */
+#define U8_OVERLONG_2 0x20 /* C0, C1 */
+#define U8_TOO_LARGE_1000 0x40
+#define U8_OVERLONG_4 0x40 /* F0 80..8F */
+#define U8_TWO_CONTS 0x80  /* a continuation nobody asked for, unless a 3/4 byte lead is 2-3 bytes back */
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+#define INGEST_GRACE_POLL_US 100 /* reload polling the reader counters, scans take microseconds */
+
+/* STRUCTS */
+typedef struct
+{
+    const char *name;
+    IngestStage run;
+} IngestStageEntry;
+
+/* FUNCTIONS */
+static int stage_utf8(IngestMsg *msg);
+static int stage_controls(IngestMsg *msg);
+static int stage_command(IngestMsg *msg);
+static int stage_terms(IngestMsg *msg);
+static void matcher_grace();
+static int ac_contains(const AcMatcher *ac, const uint8_t *s, size_t len);
+static int simd_level();
+static int utf8_valid_scalar(const uint8_t *s, size_t len);
+#ifdef INGEST_X86
+static int utf8_valid_ssse3(const uint8_t *s, size_t len);
+static int utf8_valid_avx2(const uint8_t *s, size_t len);
+static size_t find_control_sse2(const uint8_t *s, size_t len);
+static size_t find_control_avx2(const uint8_t *s, size_t len);
+#endif
+
+/* GLOBAL VARIABLES */
+int g_ingest_simd = INGEST_SIMD_AUTO;
+static IngestStageEntry g_stages[INGEST_STAGE_MAX] = {
+    {"utf8", stage_utf8},
+    {"controls", stage_controls},
+    {"command", stage_command},
+    {"terms", stage_terms}};
+static int g_stage_num = 4;
+static _Atomic(AcMatcher *) g_matcher; // current banned terms, NULL : none
+static pthread_mutex_t g_reload_mut = PTHREAD_MUTEX_INITIALIZER; // serializes reloads
+static atomic_uint g_matcher_epoch;                            // only reloads move it
+static atomic_int g_matcher_readers[2];                        // scans in progress, by the parity of the epoch they started in
+
+static const uint8_t g_u8_byte1_high[16] = {
+    U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, // 0_______
+    U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,                                                 // 10______
+    U8_TOO_SHORT | U8_OVERLONG_2,                                                                            // 1100____
+    U8_TOO_SHORT,                                                                                            // 1101____
+    U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,                                                             // 1110____
+    U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4};                                        // 1111____
+static const uint8_t g_u8_byte1_low[16] = {
+    U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4, // ____0000
+    U8_CARRY | U8_OVERLONG_2,                                 // ____0001
+    U8_CARRY, U8_CARRY,                                       // ____001_
+    U8_CARRY | U8_TOO_LARGE,                                  // ____0100
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,              // ____0101
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,              // ____1___
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE, // ____1101
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+    U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000};
+static const uint8_t g_u8_byte2_high[16] = {
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, // 0_______
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,                // 1000____
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,                                     // 1001____
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,                                      // 101_____
+    U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+    U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT};                                                       // 11______
+/* a block may not end inside a sequence : bytes above these in the last three positions start one */
+static const uint8_t g_u8_incomplete_max[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+
+/* Pipeline Functions */
+int ingest_stage_add(const char *name, IngestStage stage) // -1 : INGEST_STAGE_MAX stages already
+{
+    if (g_stage_num >= INGEST_STAGE_MAX)
+        return -1;
+    g_stages[g_stage_num++] = (IngestStageEntry){.name = name, .run = stage};
+    return 0;
+}
+
+int ingest_run(IngestMsg *msg) // runs every stage in order, msg->data stays '\0' terminated
+{
+    int verdict = INGEST_PASS;
+
+    msg->reason = NULL;
+    for (int i = 0; i < g_stage_num && verdict == INGEST_PASS; i++)
+    {
+        verdict = g_stages[i].run(msg);
+        if (verdict == INGEST_DROP && msg->reason == NULL)
+            msg->reason = g_stages[i].name;
+    }
+    if (verdict == INGEST_PASS && msg->len == 0)
+    {
+        verdict = INGEST_DROP;
+        msg->reason = "empty";
+    }
+    msg->data[msg->len] = '\0';
+    return verdict;
+}
+
+void ingest_clip(IngestMsg *msg, size_t max) // shortens a valid message to at most max bytes without splitting a character
+{
+    if (msg->len <= max)
+        return;
+    msg->len = max;
+    while (msg->len > 0 && ((uint8_t)msg->data[msg->len] & 0xC0) == 0x80)
+    {
+        msg->len--;
+    }
+    msg->data[msg->len] = '\0';
+}
+
+/* a nickname ('\0' terminated) through utf8, controls and terms, clipped to max bytes on a character boundary */
+int ingest_nickname(char *name, size_t max)
+{
+    IngestMsg msg = {.data = name, .len = strlen(name)};
+
+    if (stage_utf8(&msg) != INGEST_PASS)
+        return -1;
+    stage_controls(&msg);
+    stage_terms(&msg);
+    ingest_clip(&msg, max);
+    name[msg.len] = '\0';
+    return (msg.len > 0) ? (int)msg.len : -1;
+}
+
+static int stage_utf8(IngestMsg *msg)
+{
+    if (ingest_utf8_valid((const uint8_t *)msg->data, msg->len))
+        return INGEST_PASS;
+    msg->reason = "invalid UTF-8";
+    return INGEST_DROP;
+}
+
+static int stage_controls(IngestMsg *msg)
+{
+    msg->len = ingest_strip_controls(msg->data, msg->len);
+    return INGEST_PASS;
+}
+
+static int stage_command(IngestMsg *msg)
+{
+    return (msg->len == 4 && memcmp(msg->data, "exit", 4) == 0) ? INGEST_EXIT : INGEST_PASS;
+}
+
+static int stage_terms(IngestMsg *msg)
+{
+    unsigned int parity = atomic_load(&g_matcher_epoch) & 1;
+    AcMatcher *ac;
+
+    atomic_fetch_add(&g_matcher_readers[parity], 1); // seq_cst : counted before g_matcher is read, see matcher_grace()
+    if ((ac = atomic_load(&g_matcher)) != NULL)
+        ac_censor(ac, msg->data, msg->len);
+    atomic_fetch_sub_explicit(&g_matcher_readers[parity], 1, memory_order_release);
+    return INGEST_PASS;
+}
+
+static void matcher_grace() // g_reload_mut held, returns once no scan can still see the set g_matcher held before
+{
+    for (int flip = 0; flip < 2; flip++) // a scan may count itself in the parity of an epoch it read just before a flip
+    {
+        unsigned int parity = atomic_fetch_add(&g_matcher_epoch, 1) & 1; // new scans go to the other counter
+
+        while (atomic_load(&g_matcher_readers[parity]) != 0)
+            usleep(INGEST_GRACE_POLL_US);
+    }
+}
+
+/* Banned Term Functions */
+int ingest_load_terms(const char *path)
+{
+    AcMatcher *ac, *old;
+    int terms, states; // ac is the next reload's to free once the lock is gone
+
+    if ((ac = ac_load(path)) == NULL)
+        return -1;
+    terms = ac->terms;
+    states = ac->states;
+    pthread_mutex_lock(&g_reload_mut);
+    old = atomic_exchange(&g_matcher, ac);
+    if (old != NULL)
+    {
+        matcher_grace();
+        ac_free(old);
+    }
+    pthread_mutex_unlock(&g_reload_mut);
+    fprintf(stdout, "[INGEST] %d banned terms loaded from %s (%d states)\n", terms, path, states);
+    return terms;
+}
+
+int ingest_terms() // terms of the current set, -1 : none loaded
+{
+    AcMatcher *ac;
+    int terms;
+
+    pthread_mutex_lock(&g_reload_mut); // a reload may free the set under a bare load
+    ac = atomic_load_explicit(&g_matcher, memory_order_acquire);
+    terms = (ac != NULL) ? ac->terms : -1;
+    pthread_mutex_unlock(&g_reload_mut);
+    return terms;
+}
+
+void ingest_cleanup() // frees the current set, no receiver may be running
+{
+    pthread_mutex_lock(&g_reload_mut);
+    ac_free(atomic_exchange_explicit(&g_matcher, NULL, memory_order_acq_rel));
+    pthread_mutex_unlock(&g_reload_mut);
+}
+
+AcMatcher *ac_load(const char *path) // one term per line, '#' starts a comment line
+{
+    FILE *fp;
+    char *line = NULL, **terms = NULL, **grown;
+    size_t line_size = 0, bytes = 0;
+    ssize_t len;
+    int term_num = 0, term_cap = 0;
+    AcMatcher *ac;
+
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        fprintf(stdout, "[INGEST] Cannot open banned terms %s\n", path);
+        return NULL;
+    }
+    while ((len = getline(&line, &line_size, fp)) >= 0)
+    {
+        while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r'))
+            line[--len] = '\0';
+        if (len == 0 || line[0] == '#')
+            continue;
+        if (len > INGEST_TERM_MAX || bytes + len > INGEST_TERMS_BYTES_MAX)
+        {
+            fprintf(stdout, "[INGEST] Banned term skipped, %d bytes per term and %d in total : %.20s...\n",
+                    INGEST_TERM_MAX, INGEST_TERMS_BYTES_MAX, line);
+            continue;
+        }
+        if (term_num == term_cap)
+        {
+            term_cap = (term_cap == 0) ? 64 : term_cap * 2;
+            if ((grown = realloc(terms, term_cap * sizeof(char *))) == NULL)
+                break;
+            terms = grown;
+        }
+        terms[term_num++] = strdup(line);
+        bytes += len;
+    }
+    fclose(fp);
+    free(line);
+
+    ac = ac_build(terms, term_num);
+    for (int i = 0; i < term_num; i++)
+    {
+        free(terms[i]);
+    }
+    free(terms);
+    return ac;
+}
+
+AcMatcher *ac_build(char *const *terms, int term_num)
+{
+    AcMatcher *ac;
+    int32_t *go, *fail, *queue;
+    size_t bytes = 1;
+    int head = 0, tail = 0;
+
+    if ((ac = calloc(1, sizeof(AcMatcher))) == NULL)
+        return NULL;
+
+    /* byte classes : one per distinct (case folded) byte of the terms, the rest share class 0 */
+    ac->classes = 1;
+    for (int t = 0; t < term_num; t++)
+    {
+        for (const uint8_t *b = (const uint8_t *)terms[t]; *b != '\0'; b++)
+        {
+            uint8_t lower = (*b >= 'A' && *b <= 'Z') ? *b + 32 : *b;
+            if (ac->byte_class[lower] == 0)
+                ac->byte_class[lower] = ac->classes++;
+            bytes++;
+        }
+    }
+    for (int c = 'A'; c <= 'Z'; c++)
+    {
+        ac->byte_class[c] = ac->byte_class[c + 32];
+    }
+
+    /* trie, go[state * classes + class] = child or -1 */
+    go = malloc(bytes * ac->classes * sizeof(int32_t));
+    fail = calloc(bytes, sizeof(int32_t));
+    queue = malloc(bytes * sizeof(int32_t));
+    ac->match_len = calloc(bytes, 1);
+    ac->delta = malloc(bytes * ac->classes * sizeof(uint32_t));
+    if (go == NULL || fail == NULL || queue == NULL || ac->match_len == NULL || ac->delta == NULL)
+    {
+        free(go);
+        free(fail);
+        free(queue);
+        ac_free(ac);
+        return NULL;
+    }
+    memset(go, 0xFF, bytes * ac->classes * sizeof(int32_t));
+    ac->states = 1;
+    for (int t = 0; t < term_num; t++)
+    {
+        int32_t state = 0, depth = 0;
+
+        for (const uint8_t *b = (const uint8_t *)terms[t]; *b != '\0'; b++, depth++)
+        {
+            int32_t *next = &go[state * ac->classes + ac->byte_class[*b]];
+            if (*next < 0)
+                *next = ac->states++;
+            state = *next;
+        }
+        if (depth > 0)
+        {
+            ac->match_len[state] = depth;
+            ac->max_len = (depth > ac->max_len) ? depth : ac->max_len;
+            ac->terms++;
+        }
+    }
+
+    /* breadth first : fail links, missing edges borrowed from the fail state, matches inherited through it */
+    queue[tail++] = 0;
+    while (head < tail)
+    {
+        int32_t state = queue[head++];
+
+        for (int c = 0; c < ac->classes; c++)
+        {
+            int32_t *next = &go[state * ac->classes + c];
+            int32_t borrowed = (state == 0) ? 0 : go[fail[state] * ac->classes + c];
+
+            if (*next < 0)
+            {
+                *next = borrowed;
+                continue;
+            }
+            fail[*next] = borrowed;
+            if (ac->match_len[*next] == 0)
+                ac->match_len[*next] = ac->match_len[borrowed];
+            queue[tail++] = *next;
+        }
+    }
+    for (int i = 0; i < ac->states * ac->classes; i++)
+    {
+        ac->delta[i] = (uint32_t)go[i] * ac->classes | (ac->match_len[go[i]] ? INGEST_AC_MATCH : 0);
+    }
+    free(go);
+    free(fail);
+    free(queue);
+    return ac;
+}
+
+/*
+ * 1 : some term occurs in s. Each step waits for the previous table load,
+ * so the two halves run as separate chains the CPU overlaps, the second one
+ * starting max_len - 1 bytes early to see a term across the middle whole.
+ */
+static int ac_contains(const AcMatcher *ac, const uint8_t *s, size_t len)
+{
+    const uint32_t *delta = ac->delta;
+    const uint8_t *byte_class = ac->byte_class;
+    uint32_t a = 0, b = 0;
+    size_t half = len / 2, i = 0, j;
+
+    if (ac->terms == 0)
+        return 0;
+    if (len < 4 * (size_t)ac->max_len)
+        half = len; // too short to split, chain a alone
+    for (j = half + 1 - ac->max_len; i < half && len != half; i++, j++)
+    {
+        a = delta[a + byte_class[s[i]]];
+        b = delta[b + byte_class[s[j]]];
+        if ((a | b) & INGEST_AC_MATCH)
+            return 1;
+    }
+    for (; i < half; i++)
+    {
+        if ((a = delta[a + byte_class[s[i]]]) & INGEST_AC_MATCH)
+            return 1;
+    }
+    for (; len != half && j < len; j++)
+    {
+        if ((b = delta[b + byte_class[s[j]]]) & INGEST_AC_MATCH)
+            return 1;
+    }
+    return 0;
+}
+
+int ac_censor(const AcMatcher *ac, char *s, size_t len) // overwrites every banned term in s, returns how many matched
+{
+    const uint32_t *delta = ac->delta;
+    uint32_t row = 0;
+    int hits = 0;
+
+    if (!ac_contains(ac, (const uint8_t *)s, len)) // clean messages, the usual case, are only read
+        return 0;
+    for (size_t i = 0; i < len; i++)
+    {
+        row = delta[row + ac->byte_class[(uint8_t)s[i]]];
+        if (row & INGEST_AC_MATCH)
+        {
+            row &= ~INGEST_AC_MATCH;
+            memset(s + i + 1 - ac->match_len[row / ac->classes], INGEST_CENSOR, ac->match_len[row / ac->classes]);
+            hits++;
+        }
+    }
+    return hits;
+}
+
+void ac_free(AcMatcher *ac)
+{
+    if (ac == NULL)
+        return;
+    free(ac->delta);
+    free(ac->match_len);
+    free(ac);
+}
+
+/* Character Functions */
+static int simd_level()
+{
+    if (g_ingest_simd != INGEST_SIMD_AUTO)
+        return g_ingest_simd;
+#ifdef INGEST_X86
+    if (__builtin_cpu_supports("avx2"))
+        return INGEST_SIMD_AVX2;
+    if (__builtin_cpu_supports("ssse3"))
+        return INGEST_SIMD_SSE;
+#endif
+    return INGEST_SIMD_SCALAR;
+}
+
+int ingest_utf8_valid(const uint8_t *s, size_t len) // 1 : valid UTF-8 (no overlongs, surrogates or code points above U+10FFFF)
+{
+#ifdef INGEST_X86
+    switch (simd_level())
+    {
+    case INGEST_SIMD_AVX2:
+        return utf8_valid_avx2(s, len);
+    case INGEST_SIMD_SSE:
+        return utf8_valid_ssse3(s, len);
+    }
+#endif
+    return utf8_valid_scalar(s, len);
+}
+
+size_t ingest_strip_controls(char *s, size_t len) // removes 0x00 .. 0x1F and 0x7F, returns the new length
+{
+    const uint8_t *u = (const uint8_t *)s;
+    size_t i = 0, kept;
+    int level = simd_level();
+
+#ifdef INGEST_X86
+    if (level == INGEST_SIMD_AVX2)
+        i = find_control_avx2(u, len);
+    else if (level == INGEST_SIMD_SSE)
+        i = find_control_sse2(u, len);
+#else
+    (void)level;
+#endif
+    while (i < len && u[i] >= 0x20 && u[i] != 0x7F) // the vector scans stop at a control character or the tail
+        i++;
+    for (kept = i; i < len; i++)
+    {
+        if (u[i] >= 0x20 && u[i] != 0x7F)
+            s[kept++] = s[i];
+    }
+    return kept;
+}
+
+static int utf8_valid_scalar(const uint8_t *s, size_t len)
+{
+    size_t i = 0;
+
+    while (i < len)
+    {
+        uint64_t word;
+        uint8_t c = s[i], lo = 0x80, hi = 0xBF;
+        size_t n;
+
+        if (i + 8 <= len) // eight ASCII bytes at a time
+        {
+            memcpy(&word, s + i, 8);
+            if ((word & 0x8080808080808080ULL) == 0)
+            {
+                i += 8;
+                continue;
+            }
+        }
+        if (c < 0x80)
+        {
+            i++;
+            continue;
+        }
+        if (c >= 0xC2 && c <= 0xDF)
+            n = 1;
+        else if (c >= 0xE0 && c <= 0xEF)
+        {
+            n = 2;
+            lo = (c == 0xE0) ? 0xA0 : 0x80; // overlong
+            hi = (c == 0xED) ? 0x9F : 0xBF; // surrogates
+        }
+        else if (c >= 0xF0 && c <= 0xF4)
+        {
+            n = 3;
+            lo = (c == 0xF0) ? 0x90 : 0x80; // overlong
+            hi = (c == 0xF4) ? 0x8F : 0xBF; // above U+10FFFF
+        }
+        else
+            return 0;
+        if (len - i <= n || s[i + 1] < lo || s[i + 1] > hi)
+            return 0;
+        for (size_t k = 2; k <= n; k++)
+        {
+            if ((s[i + k] & 0xC0) != 0x80)
+                return 0;
+        }
+        i += n + 1;
+    }
+    return 1;
+}
+
+#ifdef INGEST_X86
+__attribute__((target("ssse3"))) static __m128i utf8_check_ssse3(__m128i in, __m128i prev)
+{
+    const __m128i nibble = _mm_set1_epi8(0x0F);
+    __m128i prev1 = _mm_alignr_epi8(in, prev, 15), prev2 = _mm_alignr_epi8(in, prev, 14), prev3 = _mm_alignr_epi8(in, prev, 13);
+    __m128i byte1_high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)g_u8_byte1_high), _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+    __m128i byte1_low = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)g_u8_byte1_low), _mm_and_si128(prev1, nibble));
+    __m128i byte2_high = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)g_u8_byte2_high), _mm_and_si128(_mm_srli_epi16(in, 4), nibble));
+    __m128i special = _mm_and_si128(_mm_and_si128(byte1_high, byte1_low), byte2_high);
+    __m128i must23 = _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+                                  _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+
+    return _mm_xor_si128(_mm_and_si128(must23, _mm_set1_epi8((char)0x80)), special);
+}
+
+__attribute__((target("ssse3"))) static int utf8_valid_ssse3(const uint8_t *s, size_t len)
+{
+    const __m128i incomplete_max = _mm_loadu_si128((const __m128i *)(g_u8_incomplete_max + 16));
+    __m128i prev = _mm_setzero_si128(), prev_incomplete = _mm_setzero_si128(), error = _mm_setzero_si128();
+    uint8_t tail[16];
+
+    for (size_t i = 0; i < len; i += 16)
+    {
+        __m128i in;
+
+        if (len - i >= 16)
+            in = _mm_loadu_si128((const __m128i *)(s + i));
+        else // zero padding, a sequence cut by the end shows up as too short
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, len - i);
+            in = _mm_loadu_si128((const __m128i *)tail);
+        }
+        if (_mm_movemask_epi8(in) == 0)
+        {
+            error = _mm_or_si128(error, prev_incomplete);
+            prev_incomplete = _mm_setzero_si128();
+        }
+        else
+        {
+            error = _mm_or_si128(error, utf8_check_ssse3(in, prev));
+            prev_incomplete = _mm_subs_epu8(in, incomplete_max);
+        }
+        prev = in;
+    }
+    error = _mm_or_si128(error, prev_incomplete);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) == 0xFFFF;
+}
+
+__attribute__((target("avx2"))) static __m256i utf8_check_avx2(__m256i in, __m256i prev)
+{
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i carried = _mm256_permute2x128_si256(prev, in, 0x21); // prev's high lane, in's low lane
+    __m256i prev1 = _mm256_alignr_epi8(in, carried, 15), prev2 = _mm256_alignr_epi8(in, carried, 14), prev3 = _mm256_alignr_epi8(in, carried, 13);
+    __m256i byte1_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)g_u8_byte1_high)),
+                                             _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+    __m256i byte1_low = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)g_u8_byte1_low)),
+                                            _mm256_and_si256(prev1, nibble));
+    __m256i byte2_high = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)g_u8_byte2_high)),
+                                             _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte1_high, byte1_low), byte2_high);
+    __m256i must23 = _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+                                     _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+
+    return _mm256_xor_si256(_mm256_and_si256(must23, _mm256_set1_epi8((char)0x80)), special);
+}
+
+__attribute__((target("avx2"))) static int utf8_valid_avx2(const uint8_t *s, size_t len)
+{
+    const __m256i incomplete_max = _mm256_loadu_si256((const __m256i *)g_u8_incomplete_max);
+    __m256i prev = _mm256_setzero_si256(), prev_incomplete = _mm256_setzero_si256(), error = _mm256_setzero_si256();
+    uint8_t tail[32];
+
+    for (size_t i = 0; i < len; i += 32)
+    {
+        __m256i in;
+
+        if (len - i >= 32)
+            in = _mm256_loadu_si256((const __m256i *)(s + i));
+        else
+        {
+            memset(tail, 0, sizeof(tail));
+            memcpy(tail, s + i, len - i);
+            in = _mm256_loadu_si256((const __m256i *)tail);
+        }
+        if (_mm256_movemask_epi8(in) == 0)
+        {
+            error = _mm256_or_si256(error, prev_incomplete);
+            prev_incomplete = _mm256_setzero_si256();
+        }
+        else
+        {
+            error = _mm256_or_si256(error, utf8_check_avx2(in, prev));
+            prev_incomplete = _mm256_subs_epu8(in, incomplete_max);
+        }
+        prev = in;
+    }
+    error = _mm256_or_si256(error, prev_incomplete);
+    return _mm256_testz_si256(error, error);
+}
+
+/* index of the first block holding a control character, the caller finishes byte by byte */
+__attribute__((target("sse2"))) static size_t find_control_sse2(const uint8_t *s, size_t len)
+{
+    const __m128i below = _mm_set1_epi8(0x1F), del = _mm_set1_epi8(0x7F);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i ctl = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, below), v), _mm_cmpeq_epi8(v, del));
+        if (_mm_movemask_epi8(ctl) != 0)
+            break;
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t find_control_avx2(const uint8_t *s, size_t len)
+{
+    const __m256i below = _mm256_set1_epi8(0x1F), del = _mm256_set1_epi8(0x7F);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i ctl = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, below), v), _mm256_cmpeq_epi8(v, del));
+        if (_mm256_movemask_epi8(ctl) != 0)
+            break;
+    }
+    return i + find_control_sse2(s + i, len - i);
+}
+#endif
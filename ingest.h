@@ -0,0 +1,80 @@
+/***
+ * @file ingest.h
+ * @brief ingest stage of the receivers : UTF-8 validation, control character stripping, banned-term censoring
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+#ifndef INGEST_H
+#define INGEST_H
+
+/* HEADERS */
+#include <stddef.h>
+#include <stdint.h>
+
+/* DEFINE */
+#define INGEST_STAGE_MAX 8
+#define INGEST_TERM_MAX 64            /* longest banned term in bytes, longer lines are skipped */
+#define INGEST_TERMS_BYTES_MAX 8192   /* all terms together, bounds the automaton to a few MB */
+#define INGEST_CENSOR '*'             /* replaces every byte of a banned term */
+#define INGEST_AC_MATCH 0x80000000u   /* transition flag : the target state ends a term */
+
+/* verdicts of ingest_run() and of every stage */
+enum
+{
+    INGEST_PASS = 0, /* deliver (a stage may have edited it) */
+    INGEST_DROP = 1, /* discard, reason says why */
+    INGEST_EXIT = 2  /* the "exit" command, the client leaves */
+};
+
+/* g_ingest_simd : which code the vector stages run */
+enum
+{
+    INGEST_SIMD_AUTO = -1, /* best the CPU has, checked per call */
+    INGEST_SIMD_SCALAR = 0,
+    INGEST_SIMD_SSE = 1,   /* SSE2, SSSE3 for UTF-8 */
+    INGEST_SIMD_AVX2 = 2
+};
+
+/* STRUCTS */
+typedef struct
+{
+    char *data;         // edited in place, stages may only shrink it
+    size_t len;
+    const char *reason; // set by the stage that dropped it
+} IngestMsg;
+
+typedef int (*IngestStage)(IngestMsg *msg); // returns a verdict, INGEST_PASS hands the message to the next stage
+
+typedef struct _ac_matcher
+{
+    int terms;
+    int max_len;                  // longest term
+    int states;
+    int classes;                  // byte classes, 0 : bytes no term uses
+    uint8_t byte_class[256];      // ASCII letters fold to lower case
+    uint32_t *delta;              // delta[row + class], row = state * classes, | INGEST_AC_MATCH when the target ends a term
+    uint8_t *match_len;           // longest term ending in each state, 0 : none
+} AcMatcher; // Aho-Corasick automaton of the banned terms, complete (every state has every transition)
+
+/* FUNCTIONS */
+int ingest_stage_add(const char *name, IngestStage stage); // appended after the built-in stages, before server_start()
+int ingest_run(IngestMsg *msg);
+void ingest_clip(IngestMsg *msg, size_t max);
+int ingest_nickname(char *name, size_t max); // sanitized in place, returns its length or -1 (refuse it)
+int ingest_load_terms(const char *path); // hot reload, returns the number of terms or -1 (the old set stays)
+int ingest_terms();
+void ingest_cleanup();
+
+int ingest_utf8_valid(const uint8_t *s, size_t len);
+size_t ingest_strip_controls(char *s, size_t len);
+
+AcMatcher *ac_load(const char *path);
+AcMatcher *ac_build(char *const *terms, int term_num);
+int ac_censor(const AcMatcher *ac, char *s, size_t len);
+void ac_free(AcMatcher *ac);
+
+/* GLOBAL VARIABLES */
+extern int g_ingest_simd; // INGEST_SIMD_AUTO, the benchmark pins a level
+
+#endif
@@ -0,0 +1,110 @@
+#!/bin/sh
+# Drives a server build with the load generator for profiling and PGO.
+# usage : ./profile.sh <stat|record|gprof|train> [messages] [clients] [rate msgs/s, 0 : flood] [codec] [bytes]
+#   stat   : perf stat counters of server_prof            -> profile-out/perf-stat.txt
+#   record : perf call graph of server_prof                -> profile-out/perf-report.txt
+#            (+ profile-out/flame.svg when FLAMEGRAPH_DIR points at brendangregg/FlameGraph)
+#   gprof  : flat profile / call graph of server_gprof     -> profile-out/gprof.txt
+#   train  : PGO training run of ./server, used by `make pgo`
+# bytes pads the bench messages (bench -s), deflate defaults to 256 since shorter ones are never compressed
+# SERVER_OPTS passes batch / backpressure options to the server, e.g. SERVER_OPTS="-b 100 -n 16"
+MODE=${1:-stat}
+PORT=9997
+MESSAGES=${2:-20000}
+CLIENTS=${3:-8}
+RATE=${4:-0}
+CODEC=${5:-deflate}
+if [ "$CODEC" = deflate ]; then SIZE=${6:-256}; else SIZE=${6:-0}; fi
+OUT=profile-out
+FIFO=$OUT/server.stdin
+
+# the server leaves through its CLI (option 2) so gcda / gmon.out / perf data get written
+server_run()
+{
+    rm -f $FIFO
+    mkfifo $FIFO
+    "$@" $SERVER_OPTS $PORT < $FIFO > $OUT/server.log 2>&1 &
+    SERVER_PID=$!
+    exec 3> $FIFO
+    sleep 0.5
+}
+
+server_exit()
+{
+    echo 2 >&3
+    exec 3>&-
+    wait $SERVER_PID
+    rm -f $FIFO
+}
+
+need_perf()
+{
+    if ! command -v perf > /dev/null; then
+        echo "perf is not installed (linux-perf / linux-tools package)"
+        exit 1
+    fi
+}
+
+printf '\nProfiling the server (%s) ...\n' "$MODE"
+printf "==========================\n\n"
+mkdir -p $OUT
+
+case $MODE in
+stat)
+    need_perf
+    make server_prof bench > /dev/null || exit 1
+    server_run perf stat -d -o $OUT/perf-stat.txt -- ./server_prof
+    ./bench -p $PORT -c "$CLIENTS" -m "$MESSAGES" -r "$RATE" -z "$CODEC" -s "$SIZE"
+    server_exit
+    cat $OUT/perf-stat.txt
+    ;;
+record)
+    need_perf
+    make server_prof bench > /dev/null || exit 1
+    server_run perf record -F 999 -g -o $OUT/perf.data -- ./server_prof
+    ./bench -p $PORT -c "$CLIENTS" -m "$MESSAGES" -r "$RATE" -z "$CODEC" -s "$SIZE"
+    server_exit
+    perf report -i $OUT/perf.data --stdio --no-children --percent-limit 0.5 > $OUT/perf-report.txt 2> /dev/null
+    perf report -i $OUT/perf.data --stdio --no-children --sort comm,symbol --percent-limit 1 -g none 2> /dev/null |
+        grep -E "^ +[0-9]" | head -20
+    if [ -n "$FLAMEGRAPH_DIR" ]; then
+        perf script -i $OUT/perf.data | "$FLAMEGRAPH_DIR/stackcollapse-perf.pl" | "$FLAMEGRAPH_DIR/flamegraph.pl" > $OUT/flame.svg
+        echo "flame graph : $OUT/flame.svg"
+    fi
+    echo "full report : $OUT/perf-report.txt"
+    ;;
+gprof)
+    make server_gprof bench > /dev/null || exit 1
+    rm -f gmon.out
+    server_run ./server_gprof
+    ./bench -p $PORT -c "$CLIENTS" -m "$MESSAGES" -r "$RATE" -z "$CODEC" -s "$SIZE"
+    server_exit
+    gprof ./server_gprof gmon.out > $OUT/gprof.txt
+    mv gmon.out $OUT/gmon.out
+    sed -n '/^  %/,/^$/p' $OUT/gprof.txt | head -20
+    echo "full report : $OUT/gprof.txt"
+    ;;
+train)
+    # both codecs, batching off and on, so every hot path gets counted : deflate with
+    # short messages (sent as they are) and with ones past COMPRESS_MIN_LEN (compressed)
+    for OPTS in "" "-b 100 -n 16"
+    do
+        SERVER_OPTS=$OPTS
+        server_run ./server
+        for RUN in none:0 deflate:0 deflate:512
+        do
+            ./bench -p $PORT -c "$CLIENTS" -m "$MESSAGES" -r "$RATE" -z ${RUN%%:*} -s ${RUN##*:} > /dev/null
+        done
+        server_exit
+    done
+    echo "training profile recorded."
+    ;;
+*)
+    echo "usage : $0 <stat|record|gprof|train> [messages] [clients] [rate] [codec] [bytes]"
+    exit 1
+    ;;
+esac
+
+printf "\n==========================\n"
+printf "Profiling completed.\n\n"
+exit 0
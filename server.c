@@ -9,6 +9,7 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/eventfd.h>
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <pthread.h>
@@ -17,30 +18,62 @@
 #include <string.h>
 #include <time.h>
 #include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+
+#include "chat_proto.h"
+#include "conn.h"
+#include "ingest.h"
+#include "server.h"
+#include "ws.h"
 
 /* DEFINE */
 #define DEBUG 0
 #define SERVER_IP "127.0.0.1"
 #define SERVER_PORT 9999
 
-#define MAX_CHATTER_LIM 3
+#define MAX_CHATTER_LIM 256
 #define SOCKFD_LISTEN_QUEUE_LEN MAX_CHATTER_LIM /* size of request queue */
-#define QUEUE_BUFFER_SIZE 20
+#define QUEUE_BUFFER_SIZE 256 /* must hold a full batch window of bursts */
+#define BATCH_MAX_MSGS_LIM 64 /* upper bound of messages coalesced into one send per recipient */
+#define HISTORY_SIZE 2048 /* recent messages kept by room seq for FRAME_RESEND */
+#define REPLAY_BATCH_MSGS 16
+#define PEER_MAX 8 /* outbound and inbound node links, each */
+#define PEER_RETRY_SEC 1 /* redial interval of a lost node link */
+#define PEER_OUT_MAX (1 << 20) /* relayed bytes a node may fall behind before its link is reset */
+#define PEER_SECRET_ENV "CHAT_PEER_SECRET" /* shared by every node of the mesh, -p needs it */
+#define MESSAGE_BODY_MAX (MESSAGE_MAX_LEN - 35) /* longest text that format_message() never cuts, with a 19 character nickname */
+
+enum
+{
+    CLIENT_TCP = 0,
+    CLIENT_LOCAL = 1,
+    CLIENT_TLS = 2
+}; // the listener a connection came in on, client_thread sets its transport up accordingly
 
 /* STRUCTS */
 typedef struct _client_info
 {
     int num;
-    int sockfd;
+    Conn conn; // TCP stream or, for local clients, shared memory rings
+    int codec; // CODEC_LEGACY, CODEC_PLAIN, CODEC_DEFLATE, CODEC_WEBSOCKET
+    int transport; // CLIENT_TCP, CLIENT_LOCAL, CLIENT_TLS
+    struct sockaddr_in address; // TCP and TLS clients
+    WsParser *ws; // websocket clients only, frames may arrive in pieces
+    int peer_efd; // inbound peer links only, peer_members_notify() -> peer_receiver_thread : send the count, -1 : none
     pthread_t tid;
+    pthread_mutex_t write_mut; // sender_thread 와 replay 가 같은 소켓에 프레임을 섞어 쓰지 않도록
     char nickname[20];
-} ClientInfo;
+} ClientInfo; // receiver_thread 가 소유하고, 종료할 때 해제한다
 
 typedef struct
 {
     char data[1024]; // 데이터의 예시로 문자열을 담는다고 가정
-    char *nickname;
+    char nickname[20]; // 복사본, sender_thread 가 receiver_thread 보다 오래 살 수 있음
     int client_sockfd;
+    int remote;   // 1 : relayed by a peer node, fanned out locally only and never forwarded again
+    uint32_t seq; // room sequence number, stamped by enqueue()
 } Data; // 데이터를 담을 구조체
 
 typedef struct
@@ -49,100 +82,244 @@ typedef struct
     int front;
     int rear;
     pthread_mutex_t mutex;
+    pthread_cond_t not_full;
 } Queue; // 큐 구조체 정의
 
+typedef struct
+{
+    Data items[HISTORY_SIZE]; // items[seq % HISTORY_SIZE]
+    pthread_mutex_t mutex;
+} History; // FRAME_RESEND 에 답하기 위한 최근 메시지
+
+typedef struct
+{
+    char host[INET_ADDRSTRLEN];
+    struct in_addr addr; // also the only address this node accepts an inbound link from
+    uint16_t port;
+    int sockfd;    // -1 : link down, guarded by g_peer_mut
+    int members;   // local clients of that node, from its last FRAME_PEER_MEMBERS
+    uint8_t *out;  // PEER_OUT_MAX bytes relayed but not sent yet, guarded by g_peer_mut
+    size_t out_len;
+    int wake_efd;  // sender_thread -> peer_link_thread : out has bytes to flush
+    pthread_t tid;
+} PeerInfo; // outbound node link, dialed and flushed by peer_link_thread, filled by sender_thread which never blocks on it
+
 /* FUNCTIONS */
 static inline void show_cli_list();
 static inline void init_mutex();
 static inline void destroy_mutex();
 static void enqueue(const Data *item);
-static void dequeue(Data *item);
+static int dequeue(Data *item);
+static int queue_length();
+static int wait_for_queue(const struct timespec *deadline);
+static void history_put(const Data *item);
+static int history_get(uint32_t seq, Data *item);
+static int format_message(const Data *data, char *out);
+static int client_write(ClientInfo *client_info, const void *buf, size_t len);
+static void client_notice(ClientInfo *client_info, const char *text);
+static int client_ws_opcode(const char *text, size_t len);
+static void replay(ClientInfo *client_info, z_stream *zs, uint32_t from, uint32_t to);
+static void publish(const Data *data);
+static void broadcast(const ClientInfo *client_info, const char *msg, size_t len);
+static ClientInfo *client_new();
+static int tcp_listen(uint16_t port, struct sockaddr_in *address);
+static int client_hello(ClientInfo *client_info);
+static int client_ws_hello(ClientInfo *client_info, const char *welcome);
+static int client_ws_read(ClientInfo *client_info, char *out, size_t size);
+static int client_join(ClientInfo *client_info, const char *from);
+static int client_admit(int sockfd, int transport, const struct sockaddr_in *address);
+static void client_unpend(int sockfd);
+static void client_free(ClientInfo *client_info);
+static int peer_dial(const PeerInfo *peer);
+static int peer_auth(ClientInfo *peer_info);
+static int peer_accept(ClientInfo *peer_info);
+static int peer_allowed(struct in_addr addr);
+static int peer_send(PeerInfo *peer, const uint8_t *buf, size_t len);
+static int peer_flush(PeerInfo *peer);
+static void peer_members_notify();
+static int peer_members_send(ClientInfo *peer_info);
+static int peer_frame_read(ClientInfo *peer_info, FrameHeader *hdr, uint8_t *payload, size_t payload_size);
+static void peer_forward(const Data *items, int item_num, z_stream *zs, uint8_t *out);
+static void peer_stop();
+static int client_add(ClientInfo *client_info);
+static void client_remove(ClientInfo *client_info);
+static void receiver_exit();
 void *receiver_thread(void *arg);
+void *client_thread(void *arg);
 void *server_thread(void *arg);
+void *local_thread(void *arg);
+void *tls_thread(void *arg);
 void *sender_thread(void *arg);
+void *peer_link_thread(void *arg);
+void *peer_receiver_thread(void *arg);
+void *reload_thread(void *arg);
 
 /* GLOBAL VARIABLES */
 int g_cli_choice = 1;
 int g_total_client_num; // scounts client connections
-time_t g_current_time;
+int g_batch_window_us = 0; // 0 : flush as soon as the queue is drained
+int g_batch_max_msgs = 1;  // 1 : one message per send (batching off)
+int g_drop_oldest = 0;     // full queue : 0 blocks the receivers, 1 drops the oldest message (framed clients replay the gap, the others get a notice)
+uint32_t g_room_seq;       // last stamped seq of the (single) room, guarded by g_sharedQueue.mutex
+long g_dropped_num;        // messages dropped by drop-oldest, guarded by g_sharedQueue.mutex
+int g_sender_stop;         // set by server_stop(), guarded by g_sender_mutex
+int g_receiver_num;        // live receiver and client threads, guarded by g_client_num_mut
+int g_pending_fds[MAX_CHATTER_LIM]; // sockets whose client_thread is still in the handshakes, guarded by g_client_num_mut
+int g_pending_num;         // guarded by g_client_num_mut, counts against MAX_CHATTER_LIM
+int g_client_stop;         // set once server_thread disconnects everyone, guarded by g_client_num_mut
+int g_server_sockfd = -1;
+int g_local_sockfd = -1;
+int g_next_num;            // number of the next chatter, guarded by g_client_num_mut
+uint16_t g_server_port;
+const char *g_local_path;  // unix socket of the shared memory transport, NULL : TCP only
+int g_tls_port = -1;       // TLS listener, -1 : none, 0 : ephemeral
+int g_tls_sockfd = -1;
+uint16_t g_tls_bound_port;
+const char *g_tls_cert_path, *g_tls_key_path; // NULL : throwaway self-signed certificate
+SSL_CTX *g_tls_ctx;
+int g_ws_gateway;          // 1 : the main port also takes WebSocket upgrades, native clients wait WS_SNIFF_MS longer
+const char *g_terms_path;  // banned terms, one per line, NULL : no censoring
+const char *g_peer_secret; // proves a node is part of the mesh, NULL : no links either way
+int g_peer_num;            // configured outbound links, guarded by g_peer_mut
+int g_peer_in_num;         // connected inbound links, guarded by g_peer_mut
+int g_peer_stop;           // set by server_stop(), guarded by g_peer_mut
+long g_forwarded_num;      // messages x links sent to peer nodes, guarded by g_peer_mut
+PeerInfo g_peer_arr[PEER_MAX];
+ClientInfo *g_peer_in_arr[PEER_MAX];
+pthread_t g_sender_tid, g_server_tid, g_local_tid, g_tls_tid;
 pthread_mutex_t
     g_client_num_mut,
     g_sender_mutex,
+    g_peer_mut, // lock order : g_client_num_mut -> g_peer_mut
     g_cli_sync_mutex[2]; // 0 : cli choice variable, 1 : Thread Sync
 pthread_cond_t
     g_sender_cond,
+    g_peer_cond,      // wakes peer_link_thread out of its redial wait on stop
+    g_client_num_cond, // signaled whenever a client leaves or a receiver ends
     g_cli_sync_cond;
 Queue g_sharedQueue = {.front = -1, .rear = -1, .mutex = PTHREAD_MUTEX_INITIALIZER};
-ClientInfo *g_client_info_arr[MAX_CHATTER_LIM];
+History g_history;
+ClientInfo *g_client_info_arr[MAX_CHATTER_LIM]; // 0 .. g_total_client_num - 1 are live, kept packed
 
 /* MAIN */
+#ifndef SERVER_NO_MAIN
 int main(int argc, char *argv[])
 {
-    int server_sockfd;                        /* socket file descriptors */
-    struct sockaddr_in server_address;        /* structure to hold server's address */
-    uint16_t port;                            /* protocol port number */
-    pthread_t sender_tid = 0, server_tid = 0; /* variable to hold thread ID */
+    uint16_t port; /* protocol port number */
+    int opt;
+    int peer_num = 0;
+    char *peer_addr[PEER_MAX], *sep;
+    pthread_t reload_tid;
+    sigset_t reload_signals, stop_signals;
+    int sig;
+
+    signal(SIGPIPE, SIG_IGN); // OpenSSL writes with write(2), a vanished TLS client must be an error and not a signal
 
-    if ((port = ((argc > 1) ? atoi(argv[1]) : SERVER_PORT)) <= 0)
+    while ((opt = getopt(argc, argv, "b:n:dp:u:t:c:k:wf:")) != -1)
     {
-        fprintf(stdout, "[SERVER] bad port number %s/n", argv[1]);
-        exit(EXIT_FAILURE);
+        switch (opt)
+        {
+        case 'b': // batch window (usec)
+            g_batch_window_us = atoi(optarg);
+            break;
+        case 'n': // max messages per batch
+            g_batch_max_msgs = atoi(optarg);
+            break;
+        case 'd': // drop-oldest backpressure, only framed clients can replay what was dropped
+            g_drop_oldest = 1;
+            break;
+        case 'p': // peer node "host:port", one per other node of the mesh, also the only hosts that may link in (with the secret)
+            if (peer_num < PEER_MAX && strrchr(optarg, ':') != NULL)
+            {
+                peer_addr[peer_num++] = optarg;
+                break;
+            }
+            fprintf(stdout, "[SERVER] bad peer %s, up to %d \"host:port\" peers\n", optarg, PEER_MAX);
+            exit(EXIT_FAILURE);
+        case 'u': // unix socket of the shared memory transport for same-host clients
+            g_local_path = optarg;
+            break;
+        case 't': // TLS port, OpenSSL hands the records to the kernel (kTLS) when it can
+            g_tls_port = atoi(optarg);
+            break;
+        case 'c': // TLS certificate chain (PEM)
+            g_tls_cert_path = optarg;
+            break;
+        case 'k': // TLS private key (PEM)
+            g_tls_key_path = optarg;
+            break;
+        case 'w': // WebSocket gateway on the main port
+            g_ws_gateway = 1;
+            break;
+        case 'f': // banned terms file, reloaded by CLI option 3 or SIGHUP
+            g_terms_path = optarg;
+            break;
+        default:
+            fprintf(stdout, "[SERVER] Usage: %s [-b batch_window_us] [-n batch_max_msgs] [-d] [-p peer_host:port ...] [-u local_socket_path] [-t tls_port [-c cert.pem -k key.pem]] [-w] [-f banned_terms_path] [port]\n", argv[0]);
+            fprintf(stdout, "[SERVER] -d drops the oldest messages of a full queue, framed clients replay them and legacy / WebSocket ones are told how many they missed\n");
+            fprintf(stdout, "[SERVER] -p needs the mesh's shared secret in %s\n", PEER_SECRET_ENV);
+            exit(EXIT_FAILURE);
+        }
     }
-
-    fprintf(stdout, "[SERVER] Chat Client Program Exectued.\n");
-    init_mutex();
-
-    /* setup socket settings */
-    server_sockfd = socket(AF_INET, SOCK_STREAM, 0);           // server_sockfd = socket(PF_INET, SOCK_STREAM, ptrp->p_proto);
-    server_address.sin_family = AF_INET;                       // set family to Internet
-    server_address.sin_port = htons(port);                     // change port number memory from pc's endian
-    inet_pton(AF_INET, SERVER_IP, &(server_address.sin_addr)); // set the IP address : SERVER_IP is Defined by MACRO
-    // server_address.sin_addr.s_addr = htonl(INADDR_ANY); // set the local IP address : INADDR_ANY is all local interfaces
-
-    if (server_sockfd < 0)
+    if ((g_peer_secret = getenv(PEER_SECRET_ENV)) != NULL && g_peer_secret[0] == '\0')
+        g_peer_secret = NULL;
+    if (peer_num > 0 && g_peer_secret == NULL)
     {
-        fprintf(stdout, "[SERVER] Socket creation failed\n");
+        fprintf(stdout, "[SERVER] peers need a shared secret, set %s on every node\n", PEER_SECRET_ENV);
         exit(EXIT_FAILURE);
     }
-
-    /* bind socket */
-    if (bind(server_sockfd, (const struct sockaddr *)&server_address, sizeof(server_address)) < 0)
+    if (g_batch_window_us < 0 || g_batch_max_msgs < 1 || g_batch_max_msgs > BATCH_MAX_MSGS_LIM)
     {
-        fprintf(stdout, "[SERVER] Socket bind failed\n");
+        fprintf(stdout, "[SERVER] bad batch option, window >= 0 and 1 <= max msgs <= %d\n", BATCH_MAX_MSGS_LIM);
         exit(EXIT_FAILURE);
     }
 
-    /* open socket */
-    if (listen(server_sockfd, SOCKFD_LISTEN_QUEUE_LEN) < 0)
+    if ((port = ((optind < argc) ? atoi(argv[optind]) : SERVER_PORT)) <= 0)
     {
-        fprintf(stdout, "[SERVER] Socket listen failed\n");
+        fprintf(stdout, "[SERVER] bad port number %s/n", argv[optind]);
         exit(EXIT_FAILURE);
     }
 
-    /* shows socket sconfiguration info */
-    fprintf(stdout, "[SERVER] Server up and running.\n\n\
-            - Server IP Address : %s \n\
-            - Server Port : %d\n\n",
-            inet_ntoa(server_address.sin_addr), ntohs(server_address.sin_port));
-
-    if (pthread_create(&sender_tid, NULL, sender_thread, NULL) < 0)
+    fprintf(stdout, "[SERVER] Chat Client Program Exectued.\n");
+    sigemptyset(&reload_signals); // blocked in every server thread, reload_thread takes SIGHUP with sigwait()
+    sigaddset(&reload_signals, SIGHUP);
+    sigemptyset(&stop_signals); // only main takes them, see the stdin closed case below
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, NULL);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+    if (server_start(port) < 0)
     {
-        perror("[SERVER] ERROR Occured while load Sender Thread.");
         exit(EXIT_FAILURE);
     }
-
-    if (pthread_create(&server_tid, NULL, server_thread, (void *)&server_sockfd) < 0)
+    if (pthread_create(&reload_tid, NULL, reload_thread, &reload_signals) == 0)
+        pthread_detach(reload_tid);
+    for (int i = 0; i < peer_num; i++)
     {
-        perror("[SERVER] ERROR Occured while load Server Thread.");
-        exit(EXIT_FAILURE);
+        sep = strrchr(peer_addr[i], ':');
+        *sep = '\0';
+        server_peer_add(peer_addr[i], atoi(sep + 1));
     }
+    pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL); // with a CLI they still end the process right away
 
     show_cli_list();
     while (1)
     {
-        static int cli_choice = 0;
-        static int continue_flag = 0;
-        scanf("%d", &cli_choice);
+        int cli_choice = 0;
+        int continue_flag = 0;
+        int scanned = scanf("%d", &cli_choice);
+
+        if (scanned == EOF) // stdin closed (e.g. < /dev/null) -> keep serving, SIGINT / SIGTERM then exit like option 2
+        {
+            fprintf(stdout, "[SERVER_CLI] stdin closed, running without CLI until SIGINT or SIGTERM.\n");
+            pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+            while (sigwait(&stop_signals, &sig) != 0)
+                ;
+            fprintf(stdout, "[SERVER_CLI] %s, exiting.\n", (sig == SIGINT) ? "SIGINT" : "SIGTERM");
+            break;
+        }
+        if (scanned == 0) // not a number, skip the line instead of reading it again forever
+            scanf("%*[^\n]");
 
         if (g_cli_choice == cli_choice)
         {
@@ -172,6 +349,12 @@ int main(int argc, char *argv[])
             fprintf(stdout, "[SERVER_CLI] You selected Exit Option.\n");
             fprintf(stdout, "========================================\n\n");
             break;
+        case 3: // 상태가 아니라 동작, g_cli_choice 는 그대로 둔다
+            fprintf(stdout, "\n========================================\n");
+            fprintf(stdout, "[SERVER_CLI] Banned terms reloaded : %d\n", server_terms_reload());
+            fprintf(stdout, "========================================\n\n");
+            continue_flag = 1;
+            break;
         default:
             fprintf(stdout, "\n========================================\n");
             fprintf(stdout, "[SERVER_CLI] You selected Invalid Option. Please try other Option\n");
@@ -190,18 +373,309 @@ int main(int argc, char *argv[])
         g_cli_choice = cli_choice;
         pthread_mutex_unlock(&g_cli_sync_mutex[0]);
 
-        if (g_cli_choice == 2)
+        if (cli_choice == 2)
             break;
     }
     fprintf(stdout, "[SERVER] CLI cloesd.\n");
-    pthread_detach(server_tid);
-    pthread_cancel(sender_tid);
-    pthread_join(sender_tid, NULL);
-    destroy_mutex();
-    close(server_sockfd);
+    server_stop();
     fprintf(stdout, "[SERVER] Server closed.\n");
     exit(EXIT_SUCCESS);
 }
+#endif
+
+/* Server Functions */
+int server_start(uint16_t port)
+{
+    int server_sockfd;                        /* socket file descriptors */
+    struct sockaddr_in server_address = {0}; /* structure to hold server's address */
+
+    init_mutex();
+    g_cli_choice = 1;
+    g_total_client_num = 0;
+    g_receiver_num = 0;
+    g_pending_num = 0;
+    g_client_stop = 0;
+    g_next_num = 0;
+    g_sender_stop = 0;
+    g_sharedQueue.front = g_sharedQueue.rear = -1;
+    g_room_seq = 0;
+    g_dropped_num = 0;
+    memset(g_history.items, 0, sizeof(g_history.items));
+    g_peer_num = g_peer_in_num = 0;
+    g_peer_stop = 0;
+    g_forwarded_num = 0;
+
+    /* banned terms, reloaded later by server_terms_reload() */
+    if (g_terms_path != NULL && ingest_load_terms(g_terms_path) < 0)
+    {
+        destroy_mutex();
+        return -1;
+    }
+
+    if ((server_sockfd = tcp_listen(port, &server_address)) < 0)
+    {
+        ingest_cleanup();
+        destroy_mutex();
+        return -1;
+    }
+    g_server_sockfd = server_sockfd;
+    g_server_port = ntohs(server_address.sin_port);
+
+    /* same-host clients : unix socket handshake, then shared memory rings */
+    if (g_local_path != NULL && (g_local_sockfd = conn_local_listen(g_local_path)) < 0)
+    {
+        fprintf(stdout, "[SERVER] Local socket %s failed\n", g_local_path);
+        close(server_sockfd);
+        ingest_cleanup();
+        destroy_mutex();
+        return -1;
+    }
+
+    /* TLS clients : handshake in each client's thread, records in the kernel when OpenSSL can hand them over */
+    if (g_tls_port >= 0)
+    {
+        struct sockaddr_in tls_address;
+
+        if ((g_tls_ctx = tls_server_ctx(g_tls_cert_path, g_tls_key_path)) == NULL ||
+            (g_tls_sockfd = tcp_listen(g_tls_port, &tls_address)) < 0)
+        {
+            fprintf(stdout, "[SERVER] TLS setup failed (certificate %s, port %d)\n",
+                    (g_tls_cert_path != NULL) ? g_tls_cert_path : "self-signed", g_tls_port);
+            SSL_CTX_free(g_tls_ctx);
+            g_tls_ctx = NULL;
+            if (g_local_sockfd >= 0)
+            {
+                close(g_local_sockfd);
+                unlink(g_local_path);
+                g_local_sockfd = -1;
+            }
+            close(server_sockfd);
+            ingest_cleanup();
+            destroy_mutex();
+            return -1;
+        }
+        g_tls_bound_port = ntohs(tls_address.sin_port);
+    }
+
+    /* shows socket sconfiguration info */
+    fprintf(stdout, "[SERVER] Server up and running.\n\n\
+            - Server IP Address : %s \n\
+            - Server Port : %d\n\
+            - Batch : %d usec / %d msgs\n\
+            - Backpressure : %s\n\
+            - Local Socket : %s\n\
+            - TLS Port : %d%s\n\
+            - WebSocket : %s\n\
+            - Banned Terms : %s (%d)\n\n",
+            inet_ntoa(server_address.sin_addr), ntohs(server_address.sin_port),
+            g_batch_window_us, g_batch_max_msgs, g_drop_oldest ? "drop-oldest" : "block",
+            (g_local_path != NULL) ? g_local_path : "none",
+            (g_tls_sockfd >= 0) ? g_tls_bound_port : 0, (g_tls_sockfd >= 0) ? "" : " (none)",
+            g_ws_gateway ? "on the server port" : "off",
+            (g_terms_path != NULL) ? g_terms_path : "none", (g_terms_path != NULL) ? ingest_terms() : 0);
+
+    if (pthread_create(&g_sender_tid, NULL, sender_thread, NULL) != 0)
+    {
+        perror("[SERVER] ERROR Occured while load Sender Thread.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (pthread_create(&g_server_tid, NULL, server_thread, (void *)&g_server_sockfd) != 0)
+    {
+        perror("[SERVER] ERROR Occured while load Server Thread.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (g_local_sockfd >= 0 && pthread_create(&g_local_tid, NULL, local_thread, (void *)&g_local_sockfd) != 0)
+    {
+        perror("[SERVER] ERROR Occured while load Local Thread.");
+        exit(EXIT_FAILURE);
+    }
+
+    if (g_tls_sockfd >= 0 && pthread_create(&g_tls_tid, NULL, tls_thread, (void *)&g_tls_sockfd) != 0)
+    {
+        perror("[SERVER] ERROR Occured while load TLS Thread.");
+        exit(EXIT_FAILURE);
+    }
+    return ntohs(server_address.sin_port);
+}
+
+static int tcp_listen(uint16_t port, struct sockaddr_in *address) // returns the listening socket, address gets the bound port
+{
+    int sockfd;
+    int reuse = 1;
+    socklen_t address_len = sizeof(*address);
+
+    /* setup socket settings */
+    sockfd = socket(AF_INET, SOCK_STREAM, 0);            // server_sockfd = socket(PF_INET, SOCK_STREAM, ptrp->p_proto);
+    memset(address, 0, sizeof(*address));
+    address->sin_family = AF_INET;                       // set family to Internet
+    address->sin_port = htons(port);                     // change port number memory from pc's endian, 0 : ephemeral
+    inet_pton(AF_INET, SERVER_IP, &(address->sin_addr)); // set the IP address : SERVER_IP is Defined by MACRO
+    // address->sin_addr.s_addr = htonl(INADDR_ANY); // set the local IP address : INADDR_ANY is all local interfaces
+
+    if (sockfd < 0)
+    {
+        fprintf(stdout, "[SERVER] Socket creation failed\n");
+        return -1;
+    }
+    setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    /* bind socket */
+    if (bind(sockfd, (const struct sockaddr *)address, sizeof(*address)) < 0)
+    {
+        fprintf(stdout, "[SERVER] Socket bind failed\n");
+        close(sockfd);
+        return -1;
+    }
+
+    /* open socket */
+    if (listen(sockfd, SOCKFD_LISTEN_QUEUE_LEN) < 0)
+    {
+        fprintf(stdout, "[SERVER] Socket listen failed\n");
+        close(sockfd);
+        return -1;
+    }
+    getsockname(sockfd, (struct sockaddr *)address, &address_len); // resolve an ephemeral port
+    return sockfd;
+}
+
+void server_stop()
+{
+    peer_stop();
+
+    pthread_mutex_lock(&g_cli_sync_mutex[0]);
+    g_cli_choice = 2;
+    pthread_mutex_unlock(&g_cli_sync_mutex[0]);
+
+    /* no more local clients, before server_thread sweeps the registered ones */
+    if (g_local_sockfd >= 0)
+    {
+        shutdown(g_local_sockfd, SHUT_RDWR);
+        pthread_join(g_local_tid, NULL);
+        close(g_local_sockfd);
+        unlink(g_local_path);
+        g_local_sockfd = -1;
+    }
+    if (g_tls_sockfd >= 0)
+    {
+        shutdown(g_tls_sockfd, SHUT_RDWR);
+        pthread_join(g_tls_tid, NULL);
+        close(g_tls_sockfd);
+        g_tls_sockfd = -1;
+    }
+
+    /* wake accept(), server_thread then disconnects every client and waits for them */
+    shutdown(g_server_sockfd, SHUT_RDWR);
+    pthread_join(g_server_tid, NULL);
+
+    pthread_mutex_lock(&g_sender_mutex);
+    g_sender_stop = 1;
+    pthread_cond_signal(&g_sender_cond);
+    pthread_mutex_unlock(&g_sender_mutex);
+    pthread_join(g_sender_tid, NULL);
+
+    close(g_server_sockfd);
+    g_server_sockfd = -1;
+    SSL_CTX_free(g_tls_ctx); // the sessions are gone with their receivers
+    g_tls_ctx = NULL;
+    ingest_cleanup();
+    destroy_mutex();
+}
+
+int server_terms_reload() // re-reads g_terms_path, receivers switch to the new set with their next message
+{
+    return (g_terms_path != NULL) ? ingest_load_terms(g_terms_path) : -1;
+}
+
+int server_tls_port()
+{
+    return (g_tls_sockfd >= 0) ? g_tls_bound_port : -1;
+}
+
+int server_client_count()
+{
+    int count;
+    pthread_mutex_lock(&g_client_num_mut);
+    count = g_total_client_num;
+    pthread_mutex_unlock(&g_client_num_mut);
+    return count;
+}
+
+long server_dropped_count()
+{
+    long count;
+    pthread_mutex_lock(&g_sharedQueue.mutex);
+    count = g_dropped_num;
+    pthread_mutex_unlock(&g_sharedQueue.mutex);
+    return count;
+}
+
+int server_peer_add(const char *host, uint16_t port)
+{
+    PeerInfo *peer;
+    struct in_addr addr;
+
+    if (inet_pton(AF_INET, host, &addr) != 1)
+    {
+        fprintf(stdout, "[SERVER-PEER] [ERROR] bad peer address %s\n", host);
+        return -1;
+    }
+    if (g_peer_secret == NULL)
+    {
+        fprintf(stdout, "[SERVER-PEER] [ERROR] no shared secret, peer %s:%d not added\n", host, port);
+        return -1;
+    }
+    pthread_mutex_lock(&g_peer_mut);
+    if (g_peer_num >= PEER_MAX || g_peer_stop)
+    {
+        pthread_mutex_unlock(&g_peer_mut);
+        fprintf(stdout, "[SERVER-PEER] [ERROR] there are already MAX peers : %d\n", PEER_MAX);
+        return -1;
+    }
+    peer = &g_peer_arr[g_peer_num];
+    *peer = (PeerInfo){.addr = addr, .port = port, .sockfd = -1, .out = malloc(PEER_OUT_MAX), .wake_efd = eventfd(0, 0)};
+    snprintf(peer->host, sizeof(peer->host), "%s", host);
+    if (peer->out == NULL || peer->wake_efd < 0 || pthread_create(&peer->tid, NULL, peer_link_thread, peer) != 0)
+    {
+        pthread_mutex_unlock(&g_peer_mut);
+        perror("[SERVER-PEER] ERROR Occured while load Peer Link Thread.");
+        free(peer->out);
+        if (peer->wake_efd >= 0)
+            close(peer->wake_efd);
+        return -1;
+    }
+    g_peer_num++;
+    pthread_mutex_unlock(&g_peer_mut);
+    fprintf(stdout, "[SERVER-PEER] Peer %s:%d added\n", host, port);
+    return 0;
+}
+
+int server_peer_links(int *members)
+{
+    int links = 0;
+
+    *members = 0;
+    pthread_mutex_lock(&g_peer_mut);
+    for (int i = 0; i < g_peer_num; i++)
+    {
+        if (g_peer_arr[i].sockfd < 0)
+            continue;
+        links++;
+        *members += g_peer_arr[i].members;
+    }
+    pthread_mutex_unlock(&g_peer_mut);
+    return links;
+}
+
+long server_forwarded_count()
+{
+    long count;
+    pthread_mutex_lock(&g_peer_mut);
+    count = g_forwarded_num;
+    pthread_mutex_unlock(&g_peer_mut);
+    return count;
+}
 
 /* Other Functions */
 static inline void init_mutex()
@@ -209,12 +683,17 @@ static inline void init_mutex()
     pthread_mutex_init(&g_client_num_mut, NULL);
     pthread_mutex_init(&g_sender_mutex, NULL);
     pthread_mutex_init(&g_sharedQueue.mutex, NULL);
-    for (int i = 0; i < 3; i++)
+    pthread_mutex_init(&g_history.mutex, NULL);
+    pthread_mutex_init(&g_peer_mut, NULL);
+    for (int i = 0; i < 2; i++)
     {
         pthread_mutex_init(&g_cli_sync_mutex[i], NULL);
     }
     pthread_cond_init(&g_cli_sync_cond, NULL);
     pthread_cond_init(&g_sender_cond, NULL);
+    pthread_cond_init(&g_peer_cond, NULL);
+    pthread_cond_init(&g_client_num_cond, NULL);
+    pthread_cond_init(&g_sharedQueue.not_full, NULL);
     return;
 }
 
@@ -223,12 +702,17 @@ static inline void destroy_mutex()
     pthread_mutex_destroy(&g_client_num_mut);
     pthread_mutex_destroy(&g_sender_mutex);
     pthread_mutex_destroy(&g_sharedQueue.mutex);
-    for (int i = 0; i < 3; i++)
+    pthread_mutex_destroy(&g_history.mutex);
+    pthread_mutex_destroy(&g_peer_mut);
+    for (int i = 0; i < 2; i++)
     {
         pthread_mutex_destroy(&g_cli_sync_mutex[i]);
     }
     pthread_cond_destroy(&g_cli_sync_cond);
     pthread_cond_destroy(&g_sender_cond);
+    pthread_cond_destroy(&g_peer_cond);
+    pthread_cond_destroy(&g_client_num_cond);
+    pthread_cond_destroy(&g_sharedQueue.not_full);
     return;
 }
 
@@ -238,45 +722,58 @@ static inline void show_cli_list()
     fprintf(stdout, "[SERVER CLI] 0. CLI Help\n");
     fprintf(stdout, "[SERVER CLI] 1. Open New Clients Threads(Default)\n");
     fprintf(stdout, "[SERVER CLI] 2. Exit\n");
+    fprintf(stdout, "[SERVER CLI] 3. Reload Banned Terms\n");
     fprintf(stdout, "========================================\n\n");
     fprintf(stdout, "[SERVER CLI] Enter your cli_choice: \n\n");
     return;
 }
 
-static void enqueue(const Data *item) // 데이터를 큐에 삽입하는 함수
+static void enqueue(const Data *item) // 데이터를 큐에 삽입하는 함수, 큐가 가득 차면 기다리거나 가장 오래된 데이터를 버린다
 {
     pthread_mutex_lock(&g_sharedQueue.mutex);
 
-    if ((g_sharedQueue.rear + 1) % QUEUE_BUFFER_SIZE == g_sharedQueue.front)
+    while ((g_sharedQueue.rear + 1) % QUEUE_BUFFER_SIZE == g_sharedQueue.front)
     {
+        if (g_drop_oldest) // 버려진 seq 는 history 에 남아 있어 클라이언트가 다시 요청할 수 있음
+        {
+            g_sharedQueue.front = (g_sharedQueue.front + 1) % QUEUE_BUFFER_SIZE;
+            g_dropped_num++;
 #if DEBUG
-        fprintf(stderr, "[QUEUE] Queue is full. Data not enqueued.\n"); // 큐가 가득 찬 경우
+            fprintf(stderr, "[QUEUE] Queue is full. Oldest data dropped.\n");
 #endif
-    }
-    else
-    {
-        if (g_sharedQueue.front == -1)
-        {
-            g_sharedQueue.front = 0;
+            break;
         }
-        g_sharedQueue.rear = (g_sharedQueue.rear + 1) % QUEUE_BUFFER_SIZE;
-        g_sharedQueue.items[g_sharedQueue.rear] = *item;
-        
 #if DEBUG
-        fprintf(stderr, "[QUEUE] Data enqueued.\n");
+        fprintf(stderr, "[QUEUE] Queue is full. Waiting for sender.\n"); // 큐가 가득 찬 경우
 #endif
+        pthread_cond_wait(&g_sharedQueue.not_full, &g_sharedQueue.mutex);
+    }
+
+    if (g_sharedQueue.front == -1)
+    {
+        g_sharedQueue.front = 0;
     }
+    g_sharedQueue.rear = (g_sharedQueue.rear + 1) % QUEUE_BUFFER_SIZE;
+    g_sharedQueue.items[g_sharedQueue.rear] = *item;
+    g_sharedQueue.items[g_sharedQueue.rear].seq = ++g_room_seq; // queue order == seq order == delivery order
+    history_put(&g_sharedQueue.items[g_sharedQueue.rear]);
+
+#if DEBUG
+    fprintf(stderr, "[QUEUE] Data enqueued.\n");
+#endif
 
     pthread_mutex_unlock(&g_sharedQueue.mutex);
     return;
 }
 
-static void dequeue(Data *item) // 데이터를 큐에서 추출하는 함수
+static int dequeue(Data *item) // 데이터를 큐에서 추출하는 함수, 큐가 비어 있으면 -1
 {
+    int ret = 0;
     pthread_mutex_lock(&g_sharedQueue.mutex);
 
     if (g_sharedQueue.front == -1)
     {
+        ret = -1;
 #if DEBUG
         fprintf(stderr, "[QUEUE] Queue is empty. No data to dequeue.\n"); // 큐가 비어 있는 경우
 #endif
@@ -292,119 +789,564 @@ static void dequeue(Data *item) // 데이터를 큐에서 추출하는 함수
         {
             g_sharedQueue.front = (g_sharedQueue.front + 1) % QUEUE_BUFFER_SIZE;
         }
+        pthread_cond_signal(&g_sharedQueue.not_full);
 #if DEBUG
         fprintf(stderr, "[QUEUE] Data dequeued.\n");
 #endif
     }
     pthread_mutex_unlock(&g_sharedQueue.mutex);
-    return;
+    return ret;
 }
 
-void *sender_thread(void *arg)
+static int queue_length()
 {
-    while (1)
+    int len = 0;
+    pthread_mutex_lock(&g_sharedQueue.mutex);
+    if (g_sharedQueue.front != -1)
     {
-        pthread_cond_wait(&g_sender_cond, &g_sender_mutex);
-        Data data;
-        char send_data[1044];
-        dequeue(&data);
-#if DEBUG
-        fprintf(stdout, "[SERVER] Sending Data : %d\n", data.client_sockfd);
-        fprintf(stdout, "[SERVER] Sending Data : %s\n", data.nickname);
-        fprintf(stdout, "[SERVER] Sending Data : %s\n", data.data);
-#endif
-        sprintf(send_data, "(USER NAME : %s) ", data.nickname);
-        strcat(send_data, data.data);
+        len = (g_sharedQueue.rear - g_sharedQueue.front + QUEUE_BUFFER_SIZE) % QUEUE_BUFFER_SIZE + 1;
+    }
+    pthread_mutex_unlock(&g_sharedQueue.mutex);
+    return len;
+}
 
-        pthread_mutex_lock(&g_client_num_mut);
-        for (int i = 0; i < g_total_client_num; i++)
+/* blocks until the queue has data or the deadline passes (NULL : no deadline),
+ * returns 0 with data, ETIMEDOUT on timeout, -1 when the server is stopping with nothing left to send */
+static int wait_for_queue(const struct timespec *deadline)
+{
+    int ret = 0;
+    pthread_mutex_lock(&g_sender_mutex);
+    while (queue_length() == 0 && ret != ETIMEDOUT)
+    {
+        if (g_sender_stop)
         {
-            send(g_client_info_arr[i]->sockfd, send_data, strlen(send_data), 0);
+            ret = -1;
+            break;
         }
-        pthread_mutex_unlock(&g_client_num_mut);
+        if (deadline == NULL)
+            pthread_cond_wait(&g_sender_cond, &g_sender_mutex);
+        else
+            ret = pthread_cond_timedwait(&g_sender_cond, &g_sender_mutex, deadline);
     }
-    pthread_exit(NULL);
+    pthread_mutex_unlock(&g_sender_mutex);
+    return ret;
 }
 
-void *server_thread(void *arg)
+static void history_put(const Data *item)
 {
-    char sendbuf[1024]; /* buffer for string the server sends */
-    int idx = 0;
-    int mx_chat = MAX_CHATTER_LIM;
-    int tmp_sockfd = 0;
-    int bytes_received; /* length of message received from client */
-    int cli_choice = 0;
-    int chatter_overflow_flag = 0;
-    int server_sockfd = *((int *)arg);
-    struct sockaddr_in client_address; /* structure to hold client's address */
-    socklen_t client_address_len = sizeof(client_address);
-    ClientInfo client_info[MAX_CHATTER_LIM];
+    pthread_mutex_lock(&g_history.mutex);
+    g_history.items[item->seq % HISTORY_SIZE] = *item;
+    pthread_mutex_unlock(&g_history.mutex);
+    return;
+}
 
-    while (1)
+static int history_get(uint32_t seq, Data *item) // -1 : never stamped or already overwritten
+{
+    int ret = -1;
+    pthread_mutex_lock(&g_history.mutex);
+    if (seq != 0 && g_history.items[seq % HISTORY_SIZE].seq == seq)
     {
-        pthread_mutex_lock(&g_cli_sync_mutex[0]);
-        cli_choice = g_cli_choice;
-        pthread_mutex_unlock(&g_cli_sync_mutex[0]);
+        *item = g_history.items[seq % HISTORY_SIZE];
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_history.mutex);
+    return ret;
+}
 
-        switch (cli_choice)
-        {
-        case 1: // 클라이언트 접속을 허용하는 코드를 여기에 작성합니다.
-            fprintf(stdout, "[SERVER] Listening... (New Clients can Join)\n");
-            fprintf(stdout, "[SERVER] Waiting for connection ...\n");
+static int format_message(const Data *data, char *out) // out : MESSAGE_MAX_LEN, returns the text length
+{
+    int len = snprintf(out, MESSAGE_MAX_LEN, "(USER NAME : %s) %s", data->nickname, data->data);
+    return (len >= MESSAGE_MAX_LEN) ? MESSAGE_MAX_LEN - 1 : len;
+}
 
-            if ((tmp_sockfd = accept(server_sockfd, (struct sockaddr *)&client_address, &client_address_len)) < 0)
-            {
-                fprintf(stdout, "[SERVER] Acception failed, %d\n", tmp_sockfd);
-                continue;
-            }
+static int client_write(ClientInfo *client_info, const void *buf, size_t len)
+{
+    int ret;
+    pthread_mutex_lock(&client_info->write_mut);
+    ret = conn_send_all(&client_info->conn, buf, len);
+    pthread_mutex_unlock(&client_info->write_mut);
+    return ret;
+}
 
-            pthread_mutex_lock(&g_client_num_mut);
-            if (g_total_client_num < MAX_CHATTER_LIM)
-            {
-                idx = g_total_client_num;
-                g_total_client_num++;
-            }
-            else
-            {
-                chatter_overflow_flag = 1;
-            }
-            pthread_mutex_unlock(&g_client_num_mut);
+static void client_notice(ClientInfo *client_info, const char *text) // one server message in the client's codec, outside the room seq
+{
+    uint8_t out[FRAME_MAX_SIZE];
+    size_t len = strlen(text);
+    int out_len;
 
-            if (chatter_overflow_flag == 1)
-            {
-                fprintf(stdout, "[SERVER] Connection is not permitted, there are already MAX Chatters : %d\n", mx_chat);
-                fprintf(stdout, "[SERVER] Connection is not permitted, Server Status is now 2 - Not Spawn Revceiver Threads\n");
-                close(tmp_sockfd);
-                continue;
-            }
+    if (client_info->codec == CODEC_LEGACY)
+        client_write(client_info, text, len);
+    else if (client_info->codec == CODEC_WEBSOCKET)
+        client_write(client_info, out, ws_frame_build(out, sizeof(out), client_ws_opcode(text, len), text, len, NULL));
+    else if ((out_len = frame_build(out, sizeof(out), FRAME_CHAT, 0, client_info->codec, NULL, text, len)) > 0)
+        client_write(client_info, out, out_len);
+    return;
+}
 
-            sprintf(sendbuf, "Welcome. You are \'%d\' Chatter", client_info[idx].num);
-            send(tmp_sockfd, sendbuf, strlen(sendbuf), 0);
-            bytes_received = recv(tmp_sockfd, client_info[idx].nickname, sizeof(client_info[idx].nickname) - 1, 0); // g_nickname_arr 19 character available
+static int client_ws_opcode(const char *text, size_t len) // browsers fail the whole connection on a text frame that is not UTF-8
+{
+    return ingest_utf8_valid((const uint8_t *)text, len) ? WS_OP_TEXT : WS_OP_BINARY;
+}
 
-            client_info[idx].num = 0;
-            client_info[idx].sockfd = tmp_sockfd;
-            client_info[idx].nickname[bytes_received] = '\0';
-            g_client_info_arr[idx] = (ClientInfo *)&client_info[idx];
+/* answers FRAME_RESEND with whatever of [from, to] is still in history, REPLAY_BATCH_MSGS frames per send */
+static void replay(ClientInfo *client_info, z_stream *zs, uint32_t from, uint32_t to)
+{
+    uint8_t out[REPLAY_BATCH_MSGS * FRAME_MAX_SIZE];
+    char text[MESSAGE_MAX_LEN];
+    size_t out_len = 0;
+    int frames = 0, frame_len;
+    Data data;
+
+    if (to - from >= HISTORY_SIZE)
+        from = to - HISTORY_SIZE + 1;
+    for (uint32_t n = 0; n <= to - from; n++)
+    {
+        if (history_get(from + n, &data) < 0)
+            continue;
+        frame_len = frame_build(out + out_len, FRAME_MAX_SIZE, FRAME_REPLAY, data.seq, client_info->codec, zs,
+                                text, format_message(&data, text));
+        if (frame_len < 0)
+            continue;
+        out_len += frame_len;
+        if (++frames == REPLAY_BATCH_MSGS)
+        {
+            client_write(client_info, out, out_len);
+            out_len = frames = 0;
+        }
+    }
+    if (out_len > 0)
+        client_write(client_info, out, out_len);
+    return;
+}
+
+static void publish(const Data *data) // 큐에 넣고 sender_thread 를 깨운다
+{
+    enqueue(data);
+
+    pthread_mutex_lock(&g_sender_mutex);
+    pthread_cond_signal(&g_sender_cond);
+    pthread_mutex_unlock(&g_sender_mutex);
+    return;
+}
+
+static void broadcast(const ClientInfo *client_info, const char *msg, size_t len) // len < sizeof(Data.data)
+{
+    Data data; // 필드마다 채워서 1KB 버퍼를 매번 0 으로 지우지 않는다
+
+    data.client_sockfd = client_info->conn.sockfd;
+    data.remote = 0;
+    data.seq = 0;
+    snprintf(data.nickname, sizeof(data.nickname), "%s", client_info->nickname);
+    memcpy(data.data, msg, len);
+    data.data[len] = '\0';
+    publish(&data);
+    return;
+}
+
+static ClientInfo *client_new() // numbered, not connected yet
+{
+    ClientInfo *client_info;
+
+    if ((client_info = calloc(1, sizeof(ClientInfo))) == NULL)
+        return NULL;
+    pthread_mutex_lock(&g_client_num_mut);
+    client_info->num = g_next_num++;
+    pthread_mutex_unlock(&g_client_num_mut);
+    conn_tcp(&client_info->conn, -1);
+    client_info->peer_efd = -1;
+    pthread_mutex_init(&client_info->write_mut, NULL);
+    return client_info;
+}
+
+static int client_hello(ClientInfo *client_info) // reads "<nickname>[;<codec>]", returns handshake_parse() or -1
+{
+    char hello[HANDSHAKE_BUF_SIZE]; /* "<nickname>[;<codec>]" from client */
+    int bytes_received = conn_hello_recv(&client_info->conn, hello, sizeof(hello) - 1);
+    int ret, nick_len;
+
+    if (bytes_received <= 0)
+    {
+        fprintf(stdout, "[SERVER] Client left before sending a nickname\n");
+        return -1;
+    }
+    hello[bytes_received] = '\0';
+    ret = handshake_parse(hello, &client_info->codec);
+    if ((nick_len = ingest_nickname(hello, sizeof(client_info->nickname) - 1)) < 0) // 19 bytes, never half a character
+    {
+        fprintf(stdout, "[SERVER] Nickname refused, not UTF-8 or nothing left of it\n");
+        client_notice(client_info, "Nickname must be valid UTF-8 and not empty.");
+        return -1;
+    }
+    memcpy(client_info->nickname, hello, nick_len + 1);
+    return (ret < 0) ? 0 : ret;
+}
+
+static int client_ws_hello(ClientInfo *client_info, const char *welcome) // HTTP upgrade, welcome, then the nickname as the first text message
+{
+    uint8_t frame[WS_FRAME_OVERHEAD + 1024];
+    char hello[HANDSHAKE_BUF_SIZE];
+    int nick_len;
+
+    if ((client_info->ws = malloc(sizeof(WsParser))) == NULL)
+        return -1;
+    ws_parser_init(client_info->ws, 1);
+    if (ws_accept(client_info->ws, client_info->conn.sockfd) < 0)
+    {
+        fprintf(stdout, "[SERVER] WebSocket upgrade refused\n");
+        return -1;
+    }
+    client_info->codec = CODEC_WEBSOCKET;
+    client_write(client_info, frame, ws_frame_build(frame, sizeof(frame), WS_OP_TEXT, welcome, strlen(welcome), NULL));
+    if (client_ws_read(client_info, hello, sizeof(hello)) <= 0)
+    {
+        fprintf(stdout, "[SERVER] Client left before sending a nickname\n");
+        return -1;
+    }
+    if ((nick_len = ingest_nickname(hello, sizeof(client_info->nickname) - 1)) < 0)
+    {
+        fprintf(stdout, "[SERVER] Nickname refused, not UTF-8 or nothing left of it\n");
+        client_notice(client_info, "Nickname must be valid UTF-8 and not empty.");
+        return -1;
+    }
+    memcpy(client_info->nickname, hello, nick_len + 1);
+    return 0;
+}
+
+/* next text message into out, answers pings and closes on the way, returns its length, 0 : closed, -1 : error */
+static int client_ws_read(ClientInfo *client_info, char *out, size_t size)
+{
+    WsParser *ws = client_info->ws;
+    uint8_t frame[WS_FRAME_OVERHEAD + WS_CONTROL_MAX];
+    size_t len;
+
+    while (1)
+    {
+        switch (ws_read(ws, &client_info->conn))
+        {
+        case WS_OP_TEXT:
+            if (ws->msg_len == 0) // 빈 메시지는 무시
+                continue;
+            len = (ws->msg_len < size - 1) ? ws->msg_len : size - 1;
+            memcpy(out, ws->msg, len);
+            out[len] = '\0';
+            return len;
+        case WS_OP_PING:
+            client_write(client_info, frame, ws_frame_build(frame, sizeof(frame), WS_OP_PONG, ws->ctl, ws->ctl_len, NULL));
+            continue;
+        case WS_OP_PONG:
+            continue;
+        case WS_OP_CLOSE: // 받은 상태 코드를 그대로 돌려주고 닫는다
+            client_write(client_info, frame, ws_frame_build(frame, sizeof(frame), WS_OP_CLOSE, ws->ctl, (ws->ctl_len < 2) ? ws->ctl_len : 2, NULL));
+            return 0;
+        case WS_OP_BINARY: // 채팅은 텍스트만 주고받는다
+            ws->close_code = WS_CLOSE_UNSUPPORTED;
+            /* fall through */
+        case -1:
+            if (ws->close_code != 0)
+                client_write(client_info, frame, ws_close_build(frame, sizeof(frame), ws->close_code, NULL));
+            return -1;
+        default:
+            return 0;
+        }
+    }
+}
+
+static int client_join(ClientInfo *client_info, const char *from) // registers the chatter, -1 : refused and freed
+{
+    /* registered before the receiver starts so it never misses its own join notice */
+    if (client_add(client_info) < 0) // the other acceptors took the last slots after our MAX_CHATTER_LIM check
+    {
+        fprintf(stdout, "[SERVER] Connection is not permitted, there are already MAX Chatters : %d\n", MAX_CHATTER_LIM);
+        client_notice(client_info, "Server is full, there are already MAX Chatters.");
+        client_free(client_info);
+        return -1;
+    }
+
+    fprintf(stdout, "\n\n===============================\n");
+    fprintf(stdout, "[SERVER] Connection is permitted, Total clients : %d\n", server_client_count());
+    fprintf(stderr, "[SERVER] Client connected from %s\n", from);
+    fprintf(stdout, "[SERVER] USER %d Name : %s\n", client_info->num, client_info->nickname);
+    fprintf(stdout, "[SERVER] USER %d Codec : %s\n", client_info->num, codec_name(client_info->codec));
+    fprintf(stdout, "===============================\n\n");
+    return 0;
+}
+
+/* hands an accepted socket to its own client_thread, so no handshake or sniff holds the accept loop, -1 : refused */
+static int client_admit(int sockfd, int transport, const struct sockaddr_in *address)
+{
+    ClientInfo *client_info = NULL;
+    pthread_t client_tid;
+    int admitted = 0;
+
+    pthread_mutex_lock(&g_client_num_mut);
+    if (!g_client_stop && g_total_client_num + g_pending_num < MAX_CHATTER_LIM) // handshakes in flight hold a slot too
+    {
+        g_pending_fds[g_pending_num++] = sockfd;
+        g_receiver_num++;
+        admitted = 1;
+    }
+    pthread_mutex_unlock(&g_client_num_mut);
+    if (!admitted)
+    {
+        fprintf(stdout, "[SERVER] Connection is not permitted, there are already MAX Chatters : %d\n", MAX_CHATTER_LIM);
+        close(sockfd);
+        return -1;
+    }
+
+    if ((client_info = client_new()) != NULL)
+    {
+        conn_tcp(&client_info->conn, sockfd);
+        client_info->transport = transport;
+        if (address != NULL)
+            client_info->address = *address;
+        if (pthread_create(&client_tid, NULL, client_thread, (void *)client_info) == 0)
+        {
+            pthread_detach(client_tid); // client_info now belongs to client_thread
+            return 0;
+        }
+        fprintf(stdout, "[SERVER] [ERROR] client_thread creatation Failed\n");
+    }
+    pthread_mutex_lock(&g_client_num_mut);
+    client_unpend(sockfd); // before close(), the number may come back with the next accept()
+    pthread_mutex_unlock(&g_client_num_mut);
+    if (client_info != NULL)
+        client_free(client_info);
+    else
+        close(sockfd);
+    receiver_exit();
+    return -1;
+}
+
+static void client_unpend(int sockfd) // g_client_num_mut is held, the handshakes of sockfd are over
+{
+    for (int i = 0; i < g_pending_num; i++)
+    {
+        if (g_pending_fds[i] == sockfd)
+        {
+            g_pending_fds[i] = g_pending_fds[--g_pending_num];
+            break;
+        }
+    }
+}
+
+static void client_free(ClientInfo *client_info)
+{
+    conn_close(&client_info->conn);
+    if (client_info->peer_efd >= 0)
+        close(client_info->peer_efd);
+    free(client_info->ws);
+    pthread_mutex_destroy(&client_info->write_mut);
+    free(client_info);
+    return;
+}
+
+static int client_add(ClientInfo *client_info) // returns -1 when there are already MAX Chatters or the server is stopping
+{
+    int ret = -1;
+    pthread_mutex_lock(&g_client_num_mut);
+    client_unpend(client_info->conn.sockfd); // from pending to registered in one step, server_thread sweeps both
+    if (!g_client_stop && g_total_client_num < MAX_CHATTER_LIM)
+    {
+        g_client_info_arr[g_total_client_num++] = client_info;
+        peer_members_notify();
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_client_num_mut);
+    return ret;
+}
+
+static void client_remove(ClientInfo *client_info) // 마지막 슬롯을 빈 자리로 옮겨 배열을 빈틈없이 유지
+{
+    pthread_mutex_lock(&g_client_num_mut);
+    for (int i = 0; i < g_total_client_num; i++)
+    {
+        if (g_client_info_arr[i] == client_info)
+        {
+            g_client_info_arr[i] = g_client_info_arr[--g_total_client_num];
+            g_client_info_arr[g_total_client_num] = NULL;
+            peer_members_notify();
+            break;
+        }
+    }
+    pthread_cond_broadcast(&g_client_num_cond);
+    pthread_mutex_unlock(&g_client_num_mut);
+    return;
+}
 
-            fprintf(stdout, "\n\n===============================\n");
-            fprintf(stdout, "[SERVER] Connection is permitted, Total clients : %d\n", g_total_client_num);
-            fprintf(stderr, "[SERVER] Client connected from %s:%d\n", inet_ntoa(client_address.sin_addr), ntohs(client_address.sin_port));
-            fprintf(stdout, "[SERVER] USER %d Name : %s\n", client_info[idx].num, client_info[idx].nickname);
+static void receiver_exit() // receiver_thread 가 전역 자원을 더 이상 쓰지 않음을 알린다
+{
+    pthread_mutex_lock(&g_client_num_mut);
+    g_receiver_num--;
+    pthread_cond_broadcast(&g_client_num_cond);
+    pthread_mutex_unlock(&g_client_num_mut);
+    return;
+}
+
+void *sender_thread(void *arg)
+{
+    z_stream deflate_stream = {0};
+    static Data items[BATCH_MAX_MSGS_LIM]; // 배치에 모인 메시지
+    static char texts[BATCH_MAX_MSGS_LIM][MESSAGE_MAX_LEN];
+    static size_t text_len[BATCH_MAX_MSGS_LIM];
+    uint8_t *batch[CODEC_COUNT]; // codec 별로 한 번만 만들어 모든 수신자가 공유
+    uint8_t *peer_batch;         // 피어 노드마다 한 번씩 보내는 배치
+    size_t batch_len[CODEC_COUNT];
+    int batch_built[CODEC_COUNT]; // a batch may build to 0 bytes (nothing sendable), still built once
+    struct timespec deadline;
+    int batch_msgs;
+    uint32_t last_seq = 0;    // room seq of the last message dequeued, a jump means drop-oldest shed the ones in between
+    uint32_t missed;
+    char gap_text[96];        // legacy and WebSocket clients cannot send FRAME_RESEND, they are told instead
+    int gap_len;
 
-            if (pthread_create(&(client_info[idx].tid), NULL, receiver_thread, (void *)&client_info[idx]) < 0)
+    (void)arg;
+    if (deflateInit(&deflate_stream, Z_BEST_SPEED) != Z_OK)
+    {
+        fprintf(stdout, "[SERVER] [ERROR] deflateInit failed, compression disabled\n");
+    }
+    for (int c = 0; c < CODEC_COUNT; c++)
+    {
+        if ((batch[c] = malloc((size_t)(g_batch_max_msgs + 1) * FRAME_MAX_SIZE)) == NULL) // + the gap notice
+        {
+            perror("[SERVER] ERROR Occured while allocating send batch.");
+            exit(EXIT_FAILURE);
+        }
+    }
+    if ((peer_batch = malloc((size_t)g_batch_max_msgs * FRAME_MAX_SIZE)) == NULL)
+    {
+        perror("[SERVER] ERROR Occured while allocating peer batch.");
+        exit(EXIT_FAILURE);
+    }
+
+    while (1)
+    {
+        if (wait_for_queue(NULL) < 0)
+            break;
+
+        /* collect messages until the batch is full or the window closes */
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += (long)g_batch_window_us * 1000;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000;
+        deadline.tv_nsec %= 1000000000;
+        batch_msgs = 0;
+        while (batch_msgs < g_batch_max_msgs)
+        {
+            if (dequeue(&items[batch_msgs]) < 0)
             {
-                pthread_mutex_lock(&g_client_num_mut);
-                g_total_client_num--;
-                pthread_mutex_unlock(&g_client_num_mut);
-                close(client_info[idx].sockfd);
-                fprintf(stdout, "[SERVER] [ERROR] receiver_thread creatation Failed:%ld\n", client_info[idx].tid);
-                fprintf(stdout, "[SERVER] [ERROR] Close Client Connection %d, now Total clients : %d\n", client_info[idx].sockfd, g_total_client_num);
-                fprintf(stdout, "===============================\n");
-                break;
+                if (g_batch_window_us == 0 || wait_for_queue(&deadline) != 0)
+                    break;
+                continue;
+            }
+#if DEBUG
+            fprintf(stdout, "[SERVER] Sending Data : %d\n", items[batch_msgs].client_sockfd);
+            fprintf(stdout, "[SERVER] Sending Data : %s\n", items[batch_msgs].nickname);
+            fprintf(stdout, "[SERVER] Sending Data : %s\n", items[batch_msgs].data);
+#endif
+            text_len[batch_msgs] = format_message(&items[batch_msgs], texts[batch_msgs]);
+            batch_msgs++;
+        }
+
+        for (int c = 0; c < CODEC_COUNT; c++)
+        {
+            batch_len[c] = 0;
+            batch_built[c] = 0; // 0 : 아직 만들지 않음
+        }
+        missed = 0;
+        for (int m = 0; m < batch_msgs; m++)
+        {
+            if (last_seq != 0 && items[m].seq > last_seq + 1)
+                missed += items[m].seq - last_seq - 1;
+            last_seq = items[m].seq;
+        }
+        gap_len = (missed > 0) ? snprintf(gap_text, sizeof(gap_text), "[SERVER] %u messages were dropped, the room was too busy", missed) : 0;
+
+        /* one send per recipient per batch */
+        pthread_mutex_lock(&g_client_num_mut);
+        for (int i = 0; i < g_total_client_num; i++)
+        {
+            int codec = g_client_info_arr[i]->codec;
+
+            if (!batch_built[codec])
+            {
+                batch_built[codec] = 1;
+                if (gap_len > 0 && codec == CODEC_LEGACY)
+                {
+                    memcpy(batch[codec], gap_text, gap_len);
+                    batch_len[codec] = gap_len;
+                }
+                else if (gap_len > 0 && codec == CODEC_WEBSOCKET)
+                {
+                    batch_len[codec] = ws_frame_build(batch[codec], FRAME_MAX_SIZE, WS_OP_TEXT, gap_text, gap_len, NULL);
+                }
+                for (int m = 0; m < batch_msgs; m++)
+                {
+                    int frame_len;
+
+                    if (codec == CODEC_LEGACY)
+                    {
+                        memcpy(batch[codec] + batch_len[codec], texts[m], text_len[m]);
+                        batch_len[codec] += text_len[m];
+                        continue;
+                    }
+                    if (codec == CODEC_WEBSOCKET) // 서버 프레임은 마스크가 없어 모든 웹 클라이언트가 같은 바이트를 받는다
+                    {
+                        batch_len[codec] += ws_frame_build(batch[codec] + batch_len[codec], FRAME_MAX_SIZE,
+                                                           client_ws_opcode(texts[m], text_len[m]), texts[m], text_len[m], NULL);
+                        continue;
+                    }
+                    frame_len = frame_build(batch[codec] + batch_len[codec], FRAME_MAX_SIZE, FRAME_CHAT, items[m].seq, codec,
+                                            (deflate_stream.state != NULL) ? &deflate_stream : NULL,
+                                            texts[m], text_len[m]);
+                    if (frame_len > 0)
+                        batch_len[codec] += frame_len;
+                }
+            }
+            if (batch_len[codec] > 0)
+            {
+                client_write(g_client_info_arr[i], batch[codec], batch_len[codec]);
             }
-            fprintf(stdout, "[SERVER] Receiver Thread ID : %ld\n", client_info[idx].tid);
-            fprintf(stdout, "===============================\n\n");
+        }
+        pthread_mutex_unlock(&g_client_num_mut);
+
+        /* locally received messages go to every node that has clients, once per node */
+        peer_forward(items, batch_msgs, (deflate_stream.state != NULL) ? &deflate_stream : NULL, peer_batch);
+    }
+    for (int c = 0; c < CODEC_COUNT; c++)
+    {
+        free(batch[c]);
+    }
+    free(peer_batch);
+    deflateEnd(&deflate_stream);
+    pthread_exit(NULL);
+}
+
+void *server_thread(void *arg)
+{
+    int tmp_sockfd = 0;
+    int cli_choice = 0;
+    int server_sockfd = *((int *)arg);
+    struct sockaddr_in client_address; /* structure to hold client's address */
+    socklen_t client_address_len = sizeof(client_address);
+
+    while (1)
+    {
+        pthread_mutex_lock(&g_cli_sync_mutex[0]);
+        cli_choice = g_cli_choice;
+        pthread_mutex_unlock(&g_cli_sync_mutex[0]);
+
+        switch (cli_choice)
+        {
+        case 1: // 클라이언트 접속을 허용하는 코드를 여기에 작성합니다.
+            fprintf(stdout, "[SERVER] Listening... (New Clients can Join)\n");
+            fprintf(stdout, "[SERVER] Waiting for connection ...\n");
+
+            client_address_len = sizeof(client_address);
+            if ((tmp_sockfd = accept(server_sockfd, (struct sockaddr *)&client_address, &client_address_len)) < 0)
+            {
+                fprintf(stdout, "[SERVER] Acception failed, %d\n", tmp_sockfd);
+                continue;
+            }
+            client_admit(tmp_sockfd, CLIENT_TCP, &client_address); // WebSocket sniff and nickname in client_thread
             break;
 
         case 2:
@@ -418,35 +1360,160 @@ void *server_thread(void *arg)
         if (cli_choice == 2)
             break;
     }
+
+    /* receivers see EOF, unregister themselves and free their ClientInfo */
+    pthread_mutex_lock(&g_client_num_mut);
+    g_client_stop = 1; // client_admit() and client_add() refuse from here on
     for (int i = 0; i < g_total_client_num; i++)
     {
-        close(client_info[i].sockfd);
+        conn_shutdown(&g_client_info_arr[i]->conn, SHUT_RDWR);
     }
-    sleep(1);
-    for (int i = 0; i < g_total_client_num; i++)
+    for (int i = 0; i < g_pending_num; i++) // client_thread gives up its handshake
+    {
+        shutdown(g_pending_fds[i], SHUT_RDWR);
+    }
+    pthread_mutex_lock(&g_peer_mut);
+    for (int i = 0; i < g_peer_in_num; i++)
     {
-        pthread_join(client_info[i].tid, NULL);
+        conn_shutdown(&g_peer_in_arr[i]->conn, SHUT_RDWR);
     }
+    pthread_mutex_unlock(&g_peer_mut);
+    while (g_receiver_num > 0)
+    {
+        pthread_cond_wait(&g_client_num_cond, &g_client_num_mut);
+    }
+    pthread_mutex_unlock(&g_client_num_mut);
+    pthread_exit(NULL);
+}
+
+void *local_thread(void *arg) // accepts same-host clients on the unix socket until server_stop()
+{
+    int local_sockfd = *((int *)arg);
+    int tmp_sockfd;
+
+    while ((tmp_sockfd = accept(local_sockfd, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED)
+    {
+        if (tmp_sockfd >= 0)
+            client_admit(tmp_sockfd, CLIENT_LOCAL, NULL);
+    }
+    pthread_exit(NULL);
+}
+
+void *tls_thread(void *arg) // accepts TLS clients until server_stop(), the handshakes run in client_thread
+{
+    int tls_sockfd = *((int *)arg);
+    int tmp_sockfd;
+    struct sockaddr_in client_address;
+    socklen_t client_address_len;
+
+    while (1)
+    {
+        client_address_len = sizeof(client_address);
+        if ((tmp_sockfd = accept(tls_sockfd, (struct sockaddr *)&client_address, &client_address_len)) < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break;
+        }
+        client_admit(tmp_sockfd, CLIENT_TLS, &client_address);
+    }
+    pthread_exit(NULL);
+}
+
+void *client_thread(void *arg) // transport setup and nickname handshake of one admitted connection, then its receiver
+{
+    ClientInfo *client_info = (ClientInfo *)arg;
+    int sockfd = client_info->conn.sockfd;
+    char sendbuf[1024];
+    char from[48];
+    int is_peer;
+
+    sprintf(sendbuf, "Welcome. You are \'%d\' Chatter", client_info->num);
+    if (client_info->transport == CLIENT_LOCAL)
+    {
+        if (conn_local_serve(&client_info->conn, sockfd, sendbuf, strlen(sendbuf)) < 0)
+        {
+            fprintf(stdout, "[SERVER-LOCAL] [ERROR] Shared memory setup failed\n");
+            goto refused;
+        }
+        snprintf(from, sizeof(from), "local shared memory");
+    }
+    else if (client_info->transport == CLIENT_TLS)
+    {
+        if (conn_tls(&client_info->conn, sockfd, g_tls_ctx, NULL) < 0)
+        {
+            fprintf(stdout, "[SERVER-TLS] [ERROR] TLS handshake failed\n");
+            goto refused;
+        }
+        conn_hello_send(&client_info->conn, sendbuf, strlen(sendbuf));
+        snprintf(from, sizeof(from), "%s:%d (TLS, %s)", inet_ntoa(client_info->address.sin_addr), ntohs(client_info->address.sin_port),
+                 tls_records_name(client_info->conn.ssl));
+    }
+    else if (g_ws_gateway && ws_sniff(sockfd, WS_SNIFF_MS)) // 브라우저는 welcome 을 기다리지 않고 먼저 GET 을 보낸다
+    {
+        if (client_ws_hello(client_info, sendbuf) < 0)
+            goto refused;
+        snprintf(from, sizeof(from), "%s:%d (websocket)", inet_ntoa(client_info->address.sin_addr), ntohs(client_info->address.sin_port));
+        goto join;
+    }
+    else
+    {
+        conn_hello_send(&client_info->conn, sendbuf, strlen(sendbuf));
+        snprintf(from, sizeof(from), "%s:%d", inet_ntoa(client_info->address.sin_addr), ntohs(client_info->address.sin_port));
+    }
+
+    if ((is_peer = client_hello(client_info)) < 0)
+        goto refused;
+    if (is_peer && client_info->transport != CLIENT_TCP)
+    {
+        fprintf(stdout, "[SERVER] Peer links use the plain port, %s refused\n", client_info->nickname);
+        goto refused;
+    }
+    if (is_peer) // 다른 노드의 링크, 채팅 참가자로 등록하지 않는다
+    {
+        if (peer_auth(client_info) < 0 || peer_accept(client_info) < 0)
+            goto refused;
+        return peer_receiver_thread(client_info);
+    }
+    if (client_info->transport == CLIENT_LOCAL && client_info->codec == CODEC_LEGACY) // 링은 프레임만 주고받는다
+        client_info->codec = CODEC_PLAIN;
+
+join:
+    if (client_join(client_info, from) < 0) // freed
+    {
+        receiver_exit();
+        pthread_exit(NULL);
+    }
+    return receiver_thread(client_info);
+
+refused:
+    pthread_mutex_lock(&g_client_num_mut);
+    client_unpend(sockfd); // before client_free() closes it
+    pthread_mutex_unlock(&g_client_num_mut);
+    client_free(client_info);
+    receiver_exit();
     pthread_exit(NULL);
 }
 
 void *receiver_thread(void *arg)
 {
-    char recvbuf[1024];
+    ClientInfo *client_info = (ClientInfo *)arg;
+    char recvbuf[1024 + 1]; /* legacy clients send whole 1024 byte buffers, keep room for '\0' */
+    char time_buf[32];
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    FrameHeader hdr;
+    z_stream deflate_stream = {0}; // replays to deflate clients, set up by the first FRAME_RESEND (~256 KB of zlib state)
+    int deflate_ready = 0;
+    uint32_t from, to;
     int bytes_received; /* length of message received from client */
+    time_t current_time;
+    IngestMsg msg;
+    int verdict;
 
-    ClientInfo client_info = {
-        .tid = ((ClientInfo *)arg)->tid,
-        .num = ((ClientInfo *)arg)->num,
-        .sockfd = ((ClientInfo *)arg)->sockfd,
-        .nickname = ""};
-    strcpy(client_info.nickname, ((ClientInfo *)arg)->nickname);
-
+    client_info->tid = pthread_self();
+    fprintf(stdout, "[SERVER] Receiver Thread ID : %ld\n", client_info->tid);
     /* save to Share Queue */
-    enqueue(&(Data){.client_sockfd = client_info.sockfd, .nickname = client_info.nickname, .data = "is joined to chat."});
-    pthread_mutex_lock(&g_sender_mutex);
-    pthread_cond_signal(&g_sender_cond);
-    pthread_mutex_unlock(&g_sender_mutex);
+    broadcast(client_info, "is joined to chat.", strlen("is joined to chat."));
 
 #if DEBUG
     fprintf(stdout, "DEBUG -- [SERVER] thread id:%ld\n", pthread_self());
@@ -454,15 +1521,41 @@ void *receiver_thread(void *arg)
 
     while (1)
     {
-        Data recv_data = {
-            .client_sockfd = client_info.sockfd,
-            .nickname = client_info.nickname,
-            .data = ""};
-        bytes_received = recv(client_info.sockfd, recvbuf, sizeof(recvbuf), 0);
+        if (client_info->codec == CODEC_LEGACY)
+        {
+            bytes_received = conn_recv(&client_info->conn, recvbuf, sizeof(recvbuf) - 1);
+            if (bytes_received < 0 && errno == EINTR)
+                continue;
+            if (bytes_received > 0 && (bytes_received = strnlen(recvbuf, bytes_received)) == 0) // 나머지는 NUL 패딩, 패딩뿐이면 무시
+                continue;
+        }
+        else if (client_info->codec == CODEC_WEBSOCKET)
+        {
+            bytes_received = client_ws_read(client_info, recvbuf, sizeof(recvbuf));
+        }
+        else if ((bytes_received = conn_frame_read(&client_info->conn, &hdr, payload, sizeof(payload))) > 0)
+        {
+            if (hdr.type == FRAME_RESEND)
+            {
+                if (frame_parse_resend(&hdr, payload, &from, &to) < 0)
+                    continue;
+                if (client_info->codec == CODEC_DEFLATE && !deflate_ready &&
+                    !(deflate_ready = (deflateInit(&deflate_stream, Z_BEST_SPEED) == Z_OK)))
+                    fprintf(stdout, "[SERVER-RECEIVER] [ERROR] deflateInit failed, this replay is sent uncompressed\n");
+                replay(client_info, deflate_ready ? &deflate_stream : NULL, from, to);
+                continue;
+            }
+            bytes_received = frame_decode(&hdr, NULL, payload, recvbuf, sizeof(recvbuf));
+            if (bytes_received < 0)
+            {
+                fprintf(stdout, "[SERVER-RECEIVER] [ERROR] Malformed frame dropped\n");
+                continue;
+            }
+        }
         if (bytes_received < 0)
         {
             fprintf(stdout, "[SERVER-RECEIVER] [ERROR] Error occued during receiving data\n");
-            continue;
+            break;
         }
         if (bytes_received == 0)
         {
@@ -470,40 +1563,439 @@ void *receiver_thread(void *arg)
             break;
         }
         recvbuf[bytes_received] = '\0';
-        time(&g_current_time);
+        msg = (IngestMsg){.data = recvbuf, .len = bytes_received};
+        verdict = ingest_run(&msg); // UTF-8 검사, 제어 문자 제거, 금칙어 가리기
+        time(&current_time);
         fprintf(stdout, "[SERVER-RECEIVER]\n\
             [Time] %s\
             [From] %s\n\
             [Received Data]\n\
             %s\n",
-                ctime(&g_current_time), client_info.nickname, recvbuf);
+                ctime_r(&current_time, time_buf), client_info->nickname, recvbuf);
 
-        if (strcmp(recvbuf, "exit") == 0) // exit -> send "has left chat."
+        if (verdict == INGEST_EXIT) // exit -> send "has left chat."
         {
-            strcpy(recv_data.data, "has left chat.");
-            enqueue(&recv_data);
-            pthread_mutex_lock(&g_sender_mutex);
-            pthread_cond_signal(&g_sender_cond);
-            pthread_mutex_unlock(&g_sender_mutex);
             break;
         }
-        else
+        if (verdict == INGEST_DROP)
         {
-            strcpy(recv_data.data, recvbuf); // else -> send received data
-            enqueue(&recv_data);
-            pthread_mutex_lock(&g_sender_mutex);
-            pthread_cond_signal(&g_sender_cond);
-            pthread_mutex_unlock(&g_sender_mutex);
+            fprintf(stdout, "[SERVER-RECEIVER] Message from %s dropped : %s\n", client_info->nickname, msg.reason);
+            continue;
         }
+        ingest_clip(&msg, MESSAGE_BODY_MAX);
+        broadcast(client_info, msg.data, msg.len); // else -> send received data
+    }
+
+    /* sender_thread never writes to a socket that is no longer registered */
+    client_remove(client_info);
+    broadcast(client_info, "has left chat.", strlen("has left chat."));
+    fprintf(stdout, "[SERVER] Client %d is disconnected.\n", client_info->num);
+    fprintf(stdout, "[SERVER] Total clients : %d\n", server_client_count());
+
+    if (deflate_ready)
+        deflateEnd(&deflate_stream);
+    client_free(client_info);
+    receiver_exit();
+    pthread_exit(NULL);
+}
+
+/* Peer Functions */
+static int peer_dial(const PeerInfo *peer) // returns a linked socket or -1
+{
+    int sockfd;
+    ssize_t nonce_len;
+    char buf[1024], node[HANDSHAKE_BUF_SIZE], proof[HANDSHAKE_PROOF_LEN * 2 + 1];
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(peer->port)};
+
+    inet_pton(AF_INET, peer->host, &address.sin_addr);
+    if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+        return -1;
+    if (connect(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        recv(sockfd, buf, sizeof(buf), 0) <= 0) // welcome message, nothing if the node is full
+    {
+        close(sockfd);
+        return -1;
+    }
+    snprintf(node, sizeof(node), "node%d", g_server_port);
+    snprintf(buf, sizeof(buf), "%s%c%s", node, HANDSHAKE_CODEC_SEP, HANDSHAKE_PEER);
+    if (send_all(sockfd, buf, strlen(buf)) < 0 || (nonce_len = recv(sockfd, buf, sizeof(buf) - 1, 0)) <= 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    buf[nonce_len] = '\0'; // the challenge, see handshake_peer_proof()
+    if (handshake_peer_proof(g_peer_secret, buf, node, proof, sizeof(proof)) < 0 || send_all(sockfd, proof, strlen(proof)) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+/* a node must dial from a -p address and answer the nonce with the shared secret, the address alone
+ * proves nothing on a shared host or behind NAT. -1 : refused */
+static int peer_auth(ClientInfo *peer_info)
+{
+    char nonce[HANDSHAKE_NONCE_LEN * 2 + 1], proof[HANDSHAKE_PROOF_LEN * 2 + 1], answer[HANDSHAKE_PROOF_LEN * 2 + 2];
+    ssize_t answer_len;
+    int allowed;
+
+    pthread_mutex_lock(&g_peer_mut);
+    allowed = peer_allowed(peer_info->address.sin_addr);
+    pthread_mutex_unlock(&g_peer_mut);
+    if (!allowed || g_peer_secret == NULL)
+    {
+        fprintf(stdout, "[SERVER-PEER] [ERROR] %s is not a configured peer\n", inet_ntoa(peer_info->address.sin_addr));
+        return -1;
+    }
+    if (handshake_peer_nonce(nonce, sizeof(nonce)) < 0 ||
+        handshake_peer_proof(g_peer_secret, nonce, peer_info->nickname, proof, sizeof(proof)) < 0 ||
+        conn_hello_send(&peer_info->conn, nonce, strlen(nonce)) < 0)
+        return -1;
+    answer_len = conn_hello_recv(&peer_info->conn, answer, sizeof(answer) - 1);
+    if (answer_len != HANDSHAKE_PROOF_LEN * 2 || CRYPTO_memcmp(answer, proof, HANDSHAKE_PROOF_LEN * 2) != 0)
+    {
+        fprintf(stdout, "[SERVER-PEER] [ERROR] Node %s failed the shared secret challenge\n", peer_info->nickname);
+        return -1;
     }
+    return 0;
+}
+
+static int peer_accept(ClientInfo *peer_info) // authenticated inbound link, client_thread then runs its peer_receiver_thread, -1 : refused
+{
+    int ret = -1;
+    uint64_t one = 1;
+
+    if ((peer_info->peer_efd = eventfd(0, EFD_CLOEXEC)) < 0)
+        return -1;
+    write(peer_info->peer_efd, &one, sizeof(one)); // the first count goes out as soon as peer_receiver_thread starts
 
     pthread_mutex_lock(&g_client_num_mut);
-    g_total_client_num--;
+    pthread_mutex_lock(&g_peer_mut);
+    if (g_peer_in_num < PEER_MAX && !g_peer_stop && !g_client_stop)
+    {
+        client_unpend(peer_info->conn.sockfd); // from pending to registered in one step, like client_add()
+        g_peer_in_arr[g_peer_in_num++] = peer_info;
+        fprintf(stdout, "[SERVER-PEER] Node %s linked in\n", peer_info->nickname);
+        ret = 0;
+    }
+    pthread_mutex_unlock(&g_peer_mut);
     pthread_mutex_unlock(&g_client_num_mut);
 
-    close(client_info.sockfd);
-    fprintf(stdout, "[SERVER] Client %d is disconnected.\n", client_info.num);
-    fprintf(stdout, "[SERVER] Total clients : %d\n", g_total_client_num);
+    if (ret < 0)
+        fprintf(stdout, "[SERVER-PEER] [ERROR] Node %s refused\n", peer_info->nickname);
+    return ret;
+}
+
+static int peer_allowed(struct in_addr addr) // g_peer_mut is held, only nodes given with -p may try to link in
+{
+    for (int i = 0; i < g_peer_num; i++)
+    {
+        if (g_peer_arr[i].addr.s_addr == addr.s_addr)
+            return 1;
+    }
+    return 0;
+}
+
+/* g_client_num_mut is held, so this only wakes the links : each peer_receiver_thread sends the count
+ * itself, outside every lock, and a node that stops reading stalls its own link and nothing else */
+static void peer_members_notify()
+{
+    uint64_t one = 1;
 
+    pthread_mutex_lock(&g_peer_mut);
+    for (int i = 0; i < g_peer_in_num; i++)
+    {
+        write(g_peer_in_arr[i]->peer_efd, &one, sizeof(one)); // adds up, never blocks
+    }
+    pthread_mutex_unlock(&g_peer_mut);
+    return;
+}
+
+static int peer_members_send(ClientInfo *peer_info) // peer_receiver_thread, woken : the latest count, changes in between fold into it
+{
+    uint8_t frame[FRAME_HEADER_SIZE + 4];
+    uint64_t wakes;
+    int members;
+
+    if (read(peer_info->peer_efd, &wakes, sizeof(wakes)) < 0) // before the count, a later change wakes us again
+        return -1;
+    pthread_mutex_lock(&g_client_num_mut);
+    members = g_total_client_num;
+    pthread_mutex_unlock(&g_client_num_mut);
+    return (conn_send_all(&peer_info->conn, frame, frame_build_members(frame, sizeof(frame), members)) < 0) ? -1 : 0;
+}
+
+/* conn_frame_read() for an inbound link, sending the membership count whenever it changes, <= 0 : link lost */
+static int peer_frame_read(ClientInfo *peer_info, FrameHeader *hdr, uint8_t *payload, size_t payload_size)
+{
+    struct pollfd pfd[2] = {{.fd = peer_info->conn.sockfd, .events = POLLIN}, {.fd = peer_info->peer_efd, .events = POLLIN}};
+
+    while (1)
+    {
+        if (poll(pfd, 2, -1) < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if ((pfd[1].revents & POLLIN) && peer_members_send(peer_info) < 0)
+            return -1;
+        if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+            return conn_frame_read(&peer_info->conn, hdr, payload, payload_size);
+    }
+}
+
+/* one FRAME_PEER_MSG batch of the locally received messages, built once and sent to every node with clients */
+static void peer_forward(const Data *items, int item_num, z_stream *zs, uint8_t *out)
+{
+    char payload[MESSAGE_MAX_LEN];
+    size_t out_len = 0;
+    int built = 0, forward_msgs = 0, payload_len, frame_len;
+
+    pthread_mutex_lock(&g_peer_mut);
+    for (int i = 0; i < g_peer_num; i++)
+    {
+        PeerInfo *peer = &g_peer_arr[i];
+
+        if (peer->sockfd < 0 || peer->members == 0)
+            continue;
+        if (!built)
+        {
+            for (int m = 0; m < item_num; m++)
+            {
+                if (items[m].remote)
+                    continue;
+                payload_len = snprintf(payload, sizeof(payload), "%s%c%s", items[m].nickname, '\0', items[m].data);
+                frame_len = frame_build(out + out_len, FRAME_MAX_SIZE, FRAME_PEER_MSG, 0, CODEC_DEFLATE, zs,
+                                        payload, (payload_len < (int)sizeof(payload)) ? (size_t)payload_len : sizeof(payload) - 1);
+                if (frame_len > 0)
+                {
+                    out_len += frame_len;
+                    forward_msgs++;
+                }
+            }
+            built = 1;
+        }
+        if (out_len == 0)
+            break;
+        if (peer_send(peer, out, out_len) < 0)
+        {
+            fprintf(stdout, "[SERVER-PEER] [ERROR] Node %s:%d fell behind, link reset\n", peer->host, peer->port);
+            shutdown(peer->sockfd, SHUT_RDWR); // peer_link_thread notices and redials
+            continue;
+        }
+        g_forwarded_num += forward_msgs;
+    }
+    pthread_mutex_unlock(&g_peer_mut);
+    return;
+}
+
+/* g_peer_mut is held. Never waits for the node : its peer_receiver_thread may itself be blocked on a
+ * full queue behind our own receivers, so a blocking send here could close a wait cycle across the link.
+ * What the socket does not take now is queued for peer_link_thread, -1 : more than PEER_OUT_MAX behind */
+static int peer_send(PeerInfo *peer, const uint8_t *buf, size_t len)
+{
+    ssize_t sent = 0;
+    uint64_t one = 1;
+
+    if (peer->out_len == 0 && (sent = send(peer->sockfd, buf, len, MSG_DONTWAIT | MSG_NOSIGNAL)) < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            return -1;
+        sent = 0;
+    }
+    if ((size_t)sent == len)
+        return 0;
+    if (peer->out_len + (len - sent) > PEER_OUT_MAX)
+        return -1;
+    memcpy(peer->out + peer->out_len, buf + sent, len - sent);
+    peer->out_len += len - sent;
+    if (write(peer->wake_efd, &one, sizeof(one)) < 0)
+        return -1;
+    return 0;
+}
+
+static int peer_flush(PeerInfo *peer) // peer_link_thread, the socket is writable, -1 : link lost
+{
+    ssize_t sent;
+
+    pthread_mutex_lock(&g_peer_mut);
+    sent = send(peer->sockfd, peer->out, peer->out_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent > 0)
+    {
+        memmove(peer->out, peer->out + sent, peer->out_len - sent);
+        peer->out_len -= sent;
+    }
+    pthread_mutex_unlock(&g_peer_mut);
+    return (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) ? -1 : 0;
+}
+
+static void peer_stop() // ends every outbound link, inbound ones end with the other receivers
+{
+    pthread_mutex_lock(&g_peer_mut);
+    g_peer_stop = 1;
+    for (int i = 0; i < g_peer_num; i++)
+    {
+        if (g_peer_arr[i].sockfd >= 0)
+            shutdown(g_peer_arr[i].sockfd, SHUT_RDWR);
+    }
+    pthread_cond_broadcast(&g_peer_cond);
+    pthread_mutex_unlock(&g_peer_mut);
+
+    for (int i = 0; i < g_peer_num; i++) // no more peers are added once g_peer_stop is set
+    {
+        pthread_join(g_peer_arr[i].tid, NULL);
+        free(g_peer_arr[i].out);
+        close(g_peer_arr[i].wake_efd);
+    }
+    return;
+}
+
+void *peer_link_thread(void *arg) // keeps one outbound link up, reads the node's membership summary
+{
+    PeerInfo *peer = (PeerInfo *)arg;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    FrameHeader hdr;
+    struct timespec retry;
+    struct pollfd pfd[2] = {{.fd = -1}, {.fd = peer->wake_efd, .events = POLLIN}};
+    uint64_t wakes;
+    uint32_t members;
+    int sockfd;
+
+    pthread_mutex_lock(&g_peer_mut);
+    while (!g_peer_stop)
+    {
+        pthread_mutex_unlock(&g_peer_mut);
+        sockfd = peer_dial(peer);
+        pthread_mutex_lock(&g_peer_mut);
+
+        if (sockfd < 0)
+        {
+            clock_gettime(CLOCK_REALTIME, &retry);
+            retry.tv_sec += PEER_RETRY_SEC;
+            if (!g_peer_stop)
+                pthread_cond_timedwait(&g_peer_cond, &g_peer_mut, &retry);
+            continue;
+        }
+        if (g_peer_stop)
+        {
+            close(sockfd);
+            break;
+        }
+        peer->sockfd = sockfd;
+        peer->members = 0;
+        pthread_mutex_unlock(&g_peer_mut);
+        fprintf(stdout, "[SERVER-PEER] Linked to node %s:%d\n", peer->host, peer->port);
+
+        /* membership frames in, relayed bytes sender_thread could not send right away out */
+        pfd[0].fd = sockfd;
+        while (1)
+        {
+            pthread_mutex_lock(&g_peer_mut);
+            pfd[0].events = POLLIN | ((peer->out_len > 0) ? POLLOUT : 0);
+            pthread_mutex_unlock(&g_peer_mut);
+            if (poll(pfd, 2, -1) < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            if ((pfd[1].revents & POLLIN) && read(peer->wake_efd, &wakes, sizeof(wakes)) < 0)
+                break;
+            if ((pfd[0].revents & POLLOUT) && peer_flush(peer) < 0)
+                break;
+            if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR))
+            {
+                if (frame_read(sockfd, &hdr, payload, sizeof(payload)) <= 0)
+                    break;
+                if (frame_parse_members(&hdr, payload, &members) < 0)
+                    continue;
+                pthread_mutex_lock(&g_peer_mut);
+                peer->members = members;
+                pthread_mutex_unlock(&g_peer_mut);
+            }
+        }
+
+        pthread_mutex_lock(&g_peer_mut);
+        peer->sockfd = -1;
+        peer->members = 0;
+        peer->out_len = 0;
+        close(sockfd);
+        fprintf(stdout, "[SERVER-PEER] Link to node %s:%d lost\n", peer->host, peer->port);
+    }
+    pthread_mutex_unlock(&g_peer_mut);
+    pthread_exit(NULL);
+}
+
+void *peer_receiver_thread(void *arg) // fans out what an inbound node relays
+{
+    ClientInfo *peer_info = (ClientInfo *)arg;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    char text[MESSAGE_MAX_LEN + 1];
+    z_stream inflate_stream = {0};
+    FrameHeader hdr;
+    Data data = {.client_sockfd = peer_info->conn.sockfd, .remote = 1};
+    int text_len, nick_len;
+    IngestMsg msg;
+
+    peer_info->tid = pthread_self();
+    if (inflateInit(&inflate_stream) != Z_OK)
+    {
+        fprintf(stdout, "[SERVER-PEER] [ERROR] inflateInit failed\n");
+        conn_shutdown(&peer_info->conn, SHUT_RDWR);
+    }
+
+    while (peer_frame_read(peer_info, &hdr, payload, sizeof(payload)) > 0)
+    {
+        if (hdr.type != FRAME_PEER_MSG ||
+            (text_len = frame_decode(&hdr, &inflate_stream, payload, text, sizeof(text))) < 0 ||
+            (nick_len = strlen(text)) >= text_len)
+        {
+            fprintf(stdout, "[SERVER-PEER] [ERROR] Malformed frame from node %s dropped\n", peer_info->nickname);
+            continue;
+        }
+        /* another node is no more trusted than a client, both parts go through ingest again */
+        msg = (IngestMsg){.data = text + nick_len + 1, .len = strlen(text + nick_len + 1)};
+        if ((nick_len = ingest_nickname(text, sizeof(data.nickname) - 1)) < 0 || ingest_run(&msg) != INGEST_PASS)
+        {
+            fprintf(stdout, "[SERVER-PEER] Message from node %s dropped : %s\n", peer_info->nickname,
+                    (msg.reason != NULL) ? msg.reason : "bad nickname or command");
+            continue;
+        }
+        ingest_clip(&msg, MESSAGE_BODY_MAX);
+        memcpy(data.nickname, text, nick_len + 1);
+        snprintf(data.data, sizeof(data.data), "%s", msg.data);
+        publish(&data);
+    }
+
+    pthread_mutex_lock(&g_peer_mut);
+    for (int i = 0; i < g_peer_in_num; i++)
+    {
+        if (g_peer_in_arr[i] == peer_info)
+        {
+            g_peer_in_arr[i] = g_peer_in_arr[--g_peer_in_num];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&g_peer_mut);
+    fprintf(stdout, "[SERVER-PEER] Node %s unlinked\n", peer_info->nickname);
+
+    inflateEnd(&inflate_stream);
+    client_free(peer_info);
+    receiver_exit();
     pthread_exit(NULL);
-}
\ No newline at end of file
+}
+
+/* Signal Functions */
+void *reload_thread(void *arg) // SIGHUP reloads the banned terms, for servers running without the CLI
+{
+    sigset_t *signals = (sigset_t *)arg;
+    int sig;
+
+    while (sigwait(signals, &sig) == 0)
+    {
+        fprintf(stdout, "[SERVER] SIGHUP, banned terms reloaded : %d\n", server_terms_reload());
+    }
+    pthread_exit(NULL);
+}
@@ -0,0 +1,36 @@
+/***
+ * @file server.h
+ * @brief entry points of the chat server, used by main() and the in-process tests
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+#ifndef SERVER_H
+#define SERVER_H
+
+/* HEADERS */
+#include <stdint.h>
+
+/* FUNCTIONS */
+int server_start(uint16_t port); // port 0 : ephemeral, returns the bound port or -1
+void server_stop();
+int server_client_count();
+long server_dropped_count(); // messages shed by drop-oldest since server_start()
+int server_peer_add(const char *host, uint16_t port); // dials the node and keeps the link up until server_stop()
+int server_peer_links(int *members); // connected outbound links, *members : clients behind them
+long server_forwarded_count(); // messages x links relayed to peer nodes since server_start()
+int server_tls_port(); // bound TLS port, -1 : no TLS listener
+int server_terms_reload(); // re-reads g_terms_path, returns the number of banned terms or -1
+
+/* GLOBAL VARIABLES */
+extern int g_batch_window_us;
+extern int g_batch_max_msgs;
+extern int g_drop_oldest;
+extern const char *g_local_path; // unix socket for shared memory clients, NULL : TCP only
+extern int g_tls_port;           // TLS listener, -1 : none, 0 : ephemeral
+extern const char *g_tls_cert_path, *g_tls_key_path; // NULL : throwaway self-signed certificate
+extern int g_ws_gateway;         // 1 : WebSocket upgrades on the server port
+extern const char *g_terms_path; // banned terms, one per line, NULL : no censoring
+extern const char *g_peer_secret; // shared by every node of the mesh, NULL : no peer links
+
+#endif
@@ -0,0 +1,150 @@
+/***
+ * @file shm_ring.c
+ * @brief single producer / single consumer byte ring in shared memory, eventfd wakeups
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ *
+ * The ring is a byte stream like a socket, so frames may straddle the end
+ * of the buffer or a wait. Each side only touches the eventfd when the
+ * other side announced it is about to sleep, so a busy ring moves data
+ * without any system call.
+ * That handshake is a store-buffering pattern : the sleeper stores its
+ * waiting flag then re-reads head / tail, the other side stores head / tail
+ * then reads the flag. Both pairs need a full fence between the store and
+ * the load (StoreLoad reorders even on x86), otherwise each side can miss
+ * the other's store and the wakeup is lost for good.
+ */
+
+/* HEADERS */
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "shm_ring.h"
+
+/* FUNCTIONS */
+static int shm_ring_wait(ShmRing *ring, int efd, int timeout_ms);
+
+/* Ring Functions */
+void shm_ring_init(ShmRingShared *shared)
+{
+    atomic_init(&shared->head, 0);
+    atomic_init(&shared->tail, 0);
+    atomic_init(&shared->reader_waiting, 0);
+    atomic_init(&shared->writer_waiting, 0);
+    atomic_init(&shared->closed, 0);
+}
+
+/* copies all of buf in, waiting for room as needed, returns len or -1 once the ring is closed */
+ssize_t shm_ring_write(ShmRing *ring, const void *buf, size_t len)
+{
+    ShmRingShared *shared = ring->shared;
+    const uint8_t *src = buf;
+    size_t left = len;
+
+    while (left > 0)
+    {
+        uint32_t head = atomic_load_explicit(&shared->head, memory_order_relaxed);
+        uint32_t room = SHM_RING_SIZE - (head - atomic_load_explicit(&shared->tail, memory_order_acquire));
+
+        if (atomic_load(&shared->closed))
+        {
+            errno = EPIPE;
+            return -1;
+        }
+        if (room == 0)
+        {
+            atomic_store(&shared->writer_waiting, 1);
+            room = SHM_RING_SIZE - (head - atomic_load(&shared->tail)); // the consumer may have drained meanwhile
+            if (room == 0 && !atomic_load(&shared->closed) && shm_ring_wait(ring, ring->space_efd, -1) < 0)
+            {
+                atomic_store(&shared->writer_waiting, 0);
+                errno = EPIPE;
+                return -1;
+            }
+            atomic_store(&shared->writer_waiting, 0);
+            continue;
+        }
+
+        uint32_t n = (left < room) ? left : room;
+        uint32_t at = head % SHM_RING_SIZE;
+        uint32_t first = (n < SHM_RING_SIZE - at) ? n : SHM_RING_SIZE - at; // up to the end of data[]
+
+        memcpy(shared->data + at, src, first);
+        memcpy(shared->data, src + first, n - first);
+        atomic_store_explicit(&shared->head, head + n, memory_order_release);
+        atomic_thread_fence(memory_order_seq_cst); // head before reader_waiting, pairs with the reader's seq_cst store / load
+        if (atomic_load(&shared->reader_waiting))
+            eventfd_write(ring->data_efd, 1);
+        src += n;
+        left -= n;
+    }
+    return len;
+}
+
+/* copies out whatever is there, up to len, returns the byte count, 0 once closed and drained, -1 on timeout */
+ssize_t shm_ring_read(ShmRing *ring, void *buf, size_t len, int timeout_ms)
+{
+    ShmRingShared *shared = ring->shared;
+    uint32_t tail = atomic_load_explicit(&shared->tail, memory_order_relaxed);
+    uint32_t avail;
+    int hup = 0;
+
+    while ((avail = atomic_load_explicit(&shared->head, memory_order_acquire) - tail) == 0)
+    {
+        if (hup || atomic_load(&shared->closed))
+            return 0;
+        atomic_store(&shared->reader_waiting, 1);
+        if (atomic_load(&shared->head) == tail && !atomic_load(&shared->closed)) // the producer may have written meanwhile
+        {
+            if ((hup = shm_ring_wait(ring, ring->data_efd, timeout_ms)) == 0)
+            {
+                atomic_store(&shared->reader_waiting, 0);
+                errno = EAGAIN;
+                return -1;
+            }
+            hup = (hup < 0);
+        }
+        atomic_store(&shared->reader_waiting, 0);
+    }
+
+    uint32_t n = (len < avail) ? len : avail;
+    uint32_t at = tail % SHM_RING_SIZE;
+    uint32_t first = (n < SHM_RING_SIZE - at) ? n : SHM_RING_SIZE - at;
+
+    memcpy(buf, shared->data + at, first);
+    memcpy((uint8_t *)buf + first, shared->data, n - first);
+    atomic_store_explicit(&shared->tail, tail + n, memory_order_release);
+    atomic_thread_fence(memory_order_seq_cst); // tail before writer_waiting, pairs with the writer's seq_cst store / load
+    if (atomic_load(&shared->writer_waiting))
+        eventfd_write(ring->space_efd, 1);
+    return n;
+}
+
+void shm_ring_close(ShmRing *ring) // wakes both ends, they see closed and give up
+{
+    atomic_store(&ring->shared->closed, 1);
+    eventfd_write(ring->data_efd, 1);
+    eventfd_write(ring->space_efd, 1);
+}
+
+/* sleeps on efd, returns 1 when kicked, 0 on timeout, -1 when the other side hung up */
+static int shm_ring_wait(ShmRing *ring, int efd, int timeout_ms)
+{
+    struct pollfd fds[2] = {{.fd = efd, .events = POLLIN}, {.fd = ring->hup_fd, .events = POLLIN}};
+    eventfd_t count;
+    int n;
+
+    while ((n = poll(fds, 2, timeout_ms)) < 0 && errno == EINTR)
+        ;
+    if (n == 0)
+        return 0;
+    if (fds[0].revents & POLLIN)
+    {
+        eventfd_read(efd, &count); // non-blocking, just resets the counter
+        return 1;
+    }
+    return (fds[1].revents != 0 || n < 0) ? -1 : 1;
+}
@@ -0,0 +1,46 @@
+/***
+ * @file shm_ring.h
+ * @brief single producer / single consumer byte ring in shared memory, eventfd wakeups
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+/* HEADERS */
+#include <sys/types.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* DEFINE */
+#define SHM_RING_SIZE (256 * 1024) /* power of two, head / tail wrap as uint32_t */
+#define SHM_CACHE_LINE 64
+
+/* STRUCTS */
+typedef struct
+{
+    _Atomic uint32_t head __attribute__((aligned(SHM_CACHE_LINE))); // bytes produced, stored by the producer only
+    _Atomic uint32_t tail __attribute__((aligned(SHM_CACHE_LINE))); // bytes consumed, stored by the consumer only
+    _Atomic int reader_waiting __attribute__((aligned(SHM_CACHE_LINE))); // set while the consumer sleeps on data_efd
+    _Atomic int writer_waiting; // set while the producer sleeps on space_efd
+    _Atomic int closed;         // either side gave up, readers still drain what is left
+    uint8_t data[SHM_RING_SIZE] __attribute__((aligned(SHM_CACHE_LINE)));
+} ShmRingShared; // lives in the memfd mapping shared by both processes
+
+typedef struct
+{
+    ShmRingShared *shared;
+    int data_efd;  // producer -> consumer : bytes available
+    int space_efd; // consumer -> producer : room available
+    int hup_fd;    // the handshake socket, readable once the other side is gone
+} ShmRing;
+
+/* FUNCTIONS */
+void shm_ring_init(ShmRingShared *shared);
+ssize_t shm_ring_write(ShmRing *ring, const void *buf, size_t len);
+ssize_t shm_ring_read(ShmRing *ring, void *buf, size_t len, int timeout_ms);
+void shm_ring_close(ShmRing *ring);
+
+#endif
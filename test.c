@@ -1,175 +1,1320 @@
-#include <pthread.h>
-#include <semaphore.h>
+/***
+ * @file test.c
+ * @brief in-process concurrency tests for the chat server
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ *
+ * The server runs inside this process on an ephemeral loopback port and
+ * scripted clients drive it through the real socket protocol. Every test
+ * is built from joins, leaves, floods and abrupt disconnects whose outcome
+ * does not depend on thread scheduling, so a failure is always a bug.
+ * The drop-oldest case is the exception : which messages get dropped is up
+ * to the scheduler, but every client must still end up with all of them
+ * by asking the server to replay its gaps.
+ * Federation nodes are forked once, before the first test starts any
+ * thread, and each one then runs a server per federation case on command,
+ * so every node is the same build and they all peer over loopback. A node
+ * no -p names must not get a link at all, one at a -p address still needs
+ * the mesh's secret.
+ * Local and TLS cases also open the server's unix socket or TLS port, odd
+ * clients then use that transport while even ones stay on TCP in the same
+ * room. The shm_ring_full case drives one ring directly, with a slow
+ * reader, so both sides sleep and wake each other thousands of times.
+ * TLS records go through the kernel where it has the tls module, through
+ * OpenSSL otherwise, and clients verify a throwaway certificate written
+ * for the run. The tls_verify case refuses the wrong trust or address and
+ * checks a stalled handshake does not hold the listener. WebSocket cases turn the gateway on, odd clients then upgrade
+ * on the same port and talk in masked text frames. The ingest case checks
+ * what receivers do to the text itself : invalid UTF-8, control characters,
+ * banned terms and reloading them while clients talk. The legacy case
+ * sends NUL padded buffers the way the original client does, the
+ * nickname and peer_ingest cases check the same rules hold for nicknames
+ * and for what another node relays.
+ * Build with `make test-tsan` / `make test-asan` to run under sanitizers.
+ */
+
+/* HEADERS */
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <signal.h>
 
-void *cli_thread(void *arg);
+#include "chat_proto.h"
+#include "conn.h"
+#include "server.h"
+#include "ws.h"
+
+/* DEFINE */
+#define SERVER_IP "127.0.0.1"
+#define TEST_CLIENTS 200
+#define TEST_SENDERS 20
+#define TEST_FLOOD_MSGS 50
+#define TEST_TIMEOUT_SEC 30
+#define TEST_NODES 3 /* node 0 is this process */
+#define TEST_FED_CLIENTS 40
+#define TEST_LOCAL_PATH "/tmp/chat_test.sock"
+#define TEST_TERMS_PATH "/tmp/chat_test_terms.txt"
+#define TEST_PEER_SECRET "chat-test-mesh"
+#define TEST_TLS_CERT_PATH "/tmp/chat_test_cert.pem"
+#define TEST_TLS_KEY_PATH "/tmp/chat_test_key.pem"
+#define TEST_RING_BYTES (16 * 1024 * 1024) /* 64 times the ring */
+#define TEST_RING_CHUNK 8192
+
+enum
+{
+    TEST_TCP = 0,
+    TEST_LOCAL = 1, /* odd clients through shared memory */
+    TEST_TLS = 2,   /* odd clients through TLS */
+    TEST_WS = 3     /* odd clients through WebSocket upgrades on the server port */
+};
 
-pthread_mutex_t g_cli_sync_mutex[2]; // 0 : cli choice variable, 1 : Thread Sync
-pthread_cond_t g_cli_sync_cond;
-pthread_t cli_tid;
-int g_cli_choice = 1;
+#define TEST_ASSERT(cond, ...)                                          \
+    do                                                                  \
+    {                                                                   \
+        if (!(cond))                                                    \
+        {                                                               \
+            fprintf(g_log, "[TEST] FAIL %s:%d : ", __FILE__, __LINE__);  \
+            fprintf(g_log, __VA_ARGS__);                                \
+            fprintf(g_log, "\n");                                       \
+            g_failures++;                                               \
+        }                                                               \
+    } while (0)
 
-/* ========================================
-PRIVATE FUNCTIONS
-======================================== */
-static inline void init_mutex()
+/* STRUCTS */
+typedef struct
 {
-    for (int i = 0; i < 3; i++)
+    int id;
+    Conn conn;
+    int codec;
+    WsParser *ws;                    // websocket clients only
+    uint32_t ws_frames;              // masked frames sent, varies the mask
+    pthread_t tid;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pthread_mutex_t send_mut;        // client_send and FRAME_RESEND share the socket
+    int joins;                       // "is joined to chat." seen
+    int leaves;                      // "has left chat." seen
+    int syncs;                       // "sync" seen
+    int flood;                       // distinct flood messages seen
+    int order_errors;                // live flood message out of per-sender order, or a duplicate
+    int seq_errors;                  // live room seq not increasing
+    int resends;                     // FRAME_RESEND requests sent
+    int pongs;                       // websocket pongs seen
+    int close_code;                  // status of the server's websocket close, 0 : none
+    char last[MESSAGE_MAX_LEN + 1];  // body of the last message seen
+    uint32_t room_seq;               // last live room seq, 0 : none
+    int last_seq[TEST_SENDERS];      // last live flood seq seen per sender, -1 : none
+    unsigned char seen[TEST_SENDERS][TEST_FLOOD_MSGS];
+} TestClient;
+
+typedef struct
+{
+    TestClient *client;
+    int count;
+} FloodArg;
+
+typedef struct
+{
+    ShmRing ring;
+    size_t total;
+} RingArg;
+
+typedef struct
+{
+    int batch_window_us;
+    int batch_max_msgs;
+    int drop_oldest;
+} NodeConfig; // sent to every node when a federation case starts
+
+/* FUNCTIONS */
+static int client_open(TestClient *c, int id, uint16_t port);
+static void client_send(TestClient *c, const char *msg);
+static void client_abort(TestClient *c);
+static void client_close(TestClient *c);
+static int client_wait(TestClient *c, const int *counter, int expected);
+static int client_counter(TestClient *c, const int *counter);
+static int server_wait_clients(int expected);
+static int server_wait_peers(int links, int members);
+static int tls_dial(SSL_CTX *ctx, const char *host);
+static int node_spawn();
+static void node_main(int n, int cmd_fd, int reply_fd);
+static int node_start(const NodeConfig *config, int nodes);
+static void node_link(uint16_t port, int nodes);
+static void node_stop(int nodes);
+static void node_reap();
+void *client_reader(void *arg);
+void *client_flooder(void *arg);
+void *ring_writer(void *arg);
+static void test_join_leave(uint16_t port);
+static void test_flood_ordering(uint16_t port);
+static void test_drop_oldest(uint16_t port);
+static void test_abrupt_disconnect(uint16_t port);
+static void test_federation(uint16_t port);
+static void test_peer_refused(uint16_t port);
+static void test_tls_verify(uint16_t port);
+static void test_shm_ring_full(uint16_t port);
+static void test_ws_protocol(uint16_t port);
+static void test_ingest(uint16_t port);
+static void test_legacy(uint16_t port);
+static void test_nickname(uint16_t port);
+static void test_peer_ingest(uint16_t port);
+static int legacy_open(uint16_t port, const char *hello);
+static int peer_open(uint16_t port, const char *node, const char *secret);
+static int legacy_expect(int sockfd, const char *text);
+static void terms_write(const char *terms);
+static int client_last_is(TestClient *c, const char *expected);
+
+/* GLOBAL VARIABLES */
+int g_failures = 0;
+FILE *g_log; // the real stdout, the server's own logging goes to /dev/null
+TestClient g_clients[TEST_CLIENTS];
+SSL_CTX *g_client_tls_ctx; // client side, trusts the throwaway certificate of TEST_TLS_CERT_PATH only
+uint16_t g_node_ports[TEST_NODES];
+int g_node_pipes[TEST_NODES][2]; // [0] : replies of the node, [1] : its commands, closed to end it
+pid_t g_node_pids[TEST_NODES];
+
+/* MAIN */
+int main()
+{
+    struct
+    {
+        const char *name;
+        void (*run)(uint16_t port);
+        int batch_window_us;
+        int batch_max_msgs;
+        int drop_oldest;
+        int nodes;
+        int transport; // TEST_TCP, TEST_LOCAL, TEST_TLS, TEST_WS
+    } tests[] = {
+        {"join_leave", test_join_leave, 0, 1, 0, 1, TEST_TCP},
+        {"join_leave_local", test_join_leave, 0, 1, 0, 1, TEST_LOCAL},
+        {"join_leave_tls", test_join_leave, 0, 1, 0, 1, TEST_TLS},
+        {"join_leave_ws", test_join_leave, 0, 1, 0, 1, TEST_WS},
+        {"flood_ordering", test_flood_ordering, 0, 1, 0, 1, TEST_TCP},
+        {"flood_ordering_batched", test_flood_ordering, 500, 32, 0, 1, TEST_TCP},
+        {"flood_ordering_local", test_flood_ordering, 0, 1, 0, 1, TEST_LOCAL},
+        {"flood_ordering_tls", test_flood_ordering, 0, 1, 0, 1, TEST_TLS},
+        {"flood_ordering_ws", test_flood_ordering, 500, 32, 0, 1, TEST_WS},
+        {"drop_oldest", test_drop_oldest, 0, 1, 1, 1, TEST_TCP},
+        {"abrupt_disconnect", test_abrupt_disconnect, 0, 1, 0, 1, TEST_TCP},
+        {"abrupt_disconnect_local", test_abrupt_disconnect, 0, 1, 0, 1, TEST_LOCAL},
+        {"shm_ring_full", test_shm_ring_full, 0, 1, 0, 1, TEST_TCP},
+        {"abrupt_disconnect_tls", test_abrupt_disconnect, 0, 1, 0, 1, TEST_TLS},
+        {"tls_verify", test_tls_verify, 0, 1, 0, 1, TEST_TLS},
+        {"abrupt_disconnect_ws", test_abrupt_disconnect, 0, 1, 0, 1, TEST_WS},
+        {"ws_protocol", test_ws_protocol, 0, 1, 0, 1, TEST_WS},
+        {"ingest", test_ingest, 0, 1, 0, 1, TEST_TCP},
+        {"legacy", test_legacy, 0, 1, 0, 1, TEST_TCP},
+        {"nickname", test_nickname, 0, 1, 0, 1, TEST_TCP},
+        {"peer_ingest", test_peer_ingest, 0, 1, 0, 1, TEST_TCP},
+        {"peer_refused", test_peer_refused, 0, 1, 0, 1, TEST_TCP},
+        {"federation", test_federation, 0, 1, 0, TEST_NODES, TEST_TCP},
+        {"federation_batched", test_federation, 500, 32, 0, TEST_NODES, TEST_TCP},
+    };
+    int port;
+
+    if ((g_log = fdopen(dup(STDOUT_FILENO), "w")) == NULL ||
+        freopen("/dev/null", "w", stdout) == NULL) // server logs every message to stdout
+    {
+        perror("[TEST] freopen");
+        return EXIT_FAILURE;
+    }
+    setvbuf(g_log, NULL, _IONBF, 0);
+    signal(SIGPIPE, SIG_IGN); // OpenSSL writes with write(2), like the server's own main()
+    g_peer_secret = TEST_PEER_SECRET; // before the fork, every node shares it
+    if (node_spawn() < 0) // fork() is only safe while this process has a single thread
     {
-        pthread_mutex_init(&g_cli_sync_mutex[i], NULL);
+        fprintf(g_log, "[TEST] federation nodes did not start\n");
+        return EXIT_FAILURE;
     }
-    pthread_cond_init(&g_cli_sync_cond, NULL);
+    g_tls_cert_path = TEST_TLS_CERT_PATH;
+    g_tls_key_path = TEST_TLS_KEY_PATH;
+    if (tls_cert_write(TEST_TLS_CERT_PATH, TEST_TLS_KEY_PATH) < 0 || (g_client_tls_ctx = tls_client_ctx(TEST_TLS_CERT_PATH)) == NULL)
+    {
+        fprintf(g_log, "[TEST] TLS client setup failed\n");
+        return EXIT_FAILURE;
+    }
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++)
+    {
+        int before = g_failures;
+        NodeConfig config = {tests[i].batch_window_us, tests[i].batch_max_msgs, tests[i].drop_oldest};
+
+        g_batch_window_us = tests[i].batch_window_us;
+        g_batch_max_msgs = tests[i].batch_max_msgs;
+        g_drop_oldest = tests[i].drop_oldest;
+        if (tests[i].nodes > 1 && node_start(&config, tests[i].nodes) < 0)
+        {
+            fprintf(g_log, "[TEST] FAIL %s : nodes did not start\n", tests[i].name);
+            return EXIT_FAILURE;
+        }
+        g_local_path = (tests[i].transport == TEST_LOCAL) ? TEST_LOCAL_PATH : NULL; // never set in the nodes, they do not share the socket path
+        g_tls_port = (tests[i].transport == TEST_TLS) ? 0 : -1;
+        g_ws_gateway = (tests[i].transport == TEST_WS);
+        if ((port = server_start(0)) < 0)
+        {
+            fprintf(g_log, "[TEST] FAIL %s : server did not start\n", tests[i].name);
+            return EXIT_FAILURE;
+        }
+        if (tests[i].nodes > 1)
+            node_link(port, tests[i].nodes);
+        tests[i].run(port);
+        server_stop();
+        if (tests[i].nodes > 1)
+            node_stop(tests[i].nodes);
+        fprintf(g_log, "[TEST] %s %s\n", (g_failures == before) ? "PASS" : "FAIL", tests[i].name);
+    }
+
+    SSL_CTX_free(g_client_tls_ctx);
+    unlink(TEST_TLS_CERT_PATH);
+    unlink(TEST_TLS_KEY_PATH);
+    node_reap();
+    fprintf(g_log, "[TEST] %s, %d failure(s)\n", (g_failures == 0) ? "OK" : "FAILED", g_failures);
+    return (g_failures == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
-static inline void destroy_mutex()
+/* Tests */
+static void test_join_leave(uint16_t port)
 {
-    for (int i = 0; i < 3; i++)
+    /* clients join one by one, client i sees the join notice of every client from i on */
+    for (int i = 0; i < TEST_CLIENTS; i++)
     {
-        pthread_mutex_destroy(&g_cli_sync_mutex[i]);
+        TEST_ASSERT(client_open(&g_clients[i], i, port) == 0, "client %d could not join", i);
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].joins, 1) == 0, "client %d missed its own join", i);
     }
-    pthread_cond_destroy(&g_cli_sync_cond);
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].joins, TEST_CLIENTS - i) == 0,
+                    "client %d saw %d joins, expected %d", i, g_clients[i].joins, TEST_CLIENTS - i);
+    }
+    TEST_ASSERT(server_client_count() == TEST_CLIENTS, "server counts %d clients", server_client_count());
+
+    /* the second half says "exit", everyone left sees each of them go */
+    for (int i = TEST_CLIENTS / 2; i < TEST_CLIENTS; i++)
+    {
+        client_send(&g_clients[i], "exit");
+    }
+    for (int i = 0; i < TEST_CLIENTS / 2; i++)
+    {
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].leaves, TEST_CLIENTS / 2) == 0,
+                    "client %d saw %d leaves", i, g_clients[i].leaves);
+    }
+    TEST_ASSERT(server_wait_clients(TEST_CLIENTS / 2) == 0, "server counts %d clients after exit", server_client_count());
+    for (int i = TEST_CLIENTS / 2; i < TEST_CLIENTS; i++)
+    {
+        client_close(&g_clients[i]);
+    }
+
+    /* the first half vanishes without saying goodbye */
+    for (int i = 0; i < TEST_CLIENTS / 2; i++)
+    {
+        client_abort(&g_clients[i]);
+    }
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after abort", server_client_count());
 }
 
-static inline void show_cli_list()
+static void test_flood_ordering(uint16_t port)
 {
-    fprintf(stdout, "\n========================================\n");
-    fprintf(stdout, "[SERVER CLI] 0. CLI Help\n");
-    fprintf(stdout, "[SERVER CLI] 1. Open New Clients Threads(Default)ß\n");
-    fprintf(stdout, "[SERVER CLI] 2. Close New Clients Threads\n");
-    fprintf(stdout, "[SERVER CLI] 3. Option 3\n");
-    fprintf(stdout, "[SERVER CLI] 4. Exit\n");
-    fprintf(stdout, "========================================\n\n");
-    fprintf(stdout, "[SERVER CLI] Enter your cli_choice: \n\n");
+    pthread_t flooders[TEST_SENDERS];
+    FloodArg args[TEST_SENDERS];
+    int expected = TEST_SENDERS * TEST_FLOOD_MSGS;
+
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        TEST_ASSERT(client_open(&g_clients[i], i, port) == 0, "client %d could not join", i);
+    }
+    TEST_ASSERT(server_wait_clients(TEST_CLIENTS) == 0, "server counts %d clients", server_client_count());
 
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        args[i] = (FloodArg){.client = &g_clients[i], .count = TEST_FLOOD_MSGS};
+        pthread_create(&flooders[i], NULL, client_flooder, &args[i]);
+    }
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        pthread_join(flooders[i], NULL);
+    }
+
+    /* every client gets every message, each sender's messages in the order sent */
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].flood, expected) == 0,
+                    "client %d got %d of %d flood messages", i, g_clients[i].flood, expected);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].order_errors) == 0, "client %d saw out of order messages", i);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].seq_errors) == 0, "client %d saw room seq going back", i);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].resends) == 0, "client %d saw a gap without drop-oldest", i);
+    }
+
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        client_send(&g_clients[i], "exit");
+        client_close(&g_clients[i]);
+    }
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after exit", server_client_count());
 }
 
-/* ========================================
-MAIN INLINE FUNCTIONS
-======================================== */
-int main()
+static void test_drop_oldest(uint16_t port)
 {
-    int cli_choice = 0;
-    init_mutex();
+    pthread_t flooders[TEST_SENDERS];
+    FloodArg args[TEST_SENDERS];
+    int expected = TEST_SENDERS * TEST_FLOOD_MSGS;
+    int resends = 0;
+    int legacy_fd;
 
-    if (pthread_create(&cli_tid, NULL, cli_thread, NULL) < 0) // 여기서 tid값은 thread내에서 pthread_self()반환값
+    for (int i = 0; i < TEST_CLIENTS; i++)
     {
-        perror("[SERVER] recv_thread create error:");
-        exit(EXIT_FAILURE);
+        TEST_ASSERT(client_open(&g_clients[i], i, port) == 0, "client %d could not join", i);
     }
+    TEST_ASSERT((legacy_fd = legacy_open(port, "legacy")) >= 0, "legacy client could not join"); // no FRAME_RESEND, gets told instead
+    TEST_ASSERT(server_wait_clients(TEST_CLIENTS + 1) == 0, "server counts %d clients", server_client_count());
 
-    while (1)
+    /* senders never block, the queue sheds the oldest messages instead */
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        args[i] = (FloodArg){.client = &g_clients[i], .count = TEST_FLOOD_MSGS};
+        pthread_create(&flooders[i], NULL, client_flooder, &args[i]);
+    }
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        pthread_join(flooders[i], NULL);
+    }
+
+    /* live frames stay in order and every gap is filled from history */
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].flood, expected) == 0,
+                    "client %d got %d of %d flood messages", i, g_clients[i].flood, expected);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].order_errors) == 0, "client %d saw out of order messages", i);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].seq_errors) == 0, "client %d saw room seq going back", i);
+        resends += client_counter(&g_clients[i], &g_clients[i].resends);
+    }
+    fprintf(g_log, "[TEST] drop_oldest : %ld dropped, %d resend requests\n", server_dropped_count(), resends);
+    TEST_ASSERT(server_dropped_count() == 0 || resends > 0, "messages were dropped but nobody asked for them");
+    TEST_ASSERT(server_dropped_count() == 0 || legacy_expect(legacy_fd, "messages were dropped") == 0,
+                "messages were dropped but the legacy client was not told");
+    close(legacy_fd);
+
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        client_send(&g_clients[i], "exit");
+        client_close(&g_clients[i]);
+    }
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after exit", server_client_count());
+}
+
+static void test_abrupt_disconnect(uint16_t port)
+{
+    pthread_t flooders[TEST_SENDERS];
+    FloodArg args[TEST_SENDERS];
+    int survivors = TEST_CLIENTS / 2;
+    int expected = TEST_SENDERS * TEST_FLOOD_MSGS;
+
+    for (int i = 0; i < TEST_CLIENTS; i++)
+    {
+        TEST_ASSERT(client_open(&g_clients[i], i, port) == 0, "client %d could not join", i);
+    }
+    TEST_ASSERT(server_wait_clients(TEST_CLIENTS) == 0, "server counts %d clients", server_client_count());
+
+    /* the second half resets its connections while the first senders flood */
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        args[i] = (FloodArg){.client = &g_clients[i], .count = TEST_FLOOD_MSGS};
+        pthread_create(&flooders[i], NULL, client_flooder, &args[i]);
+    }
+    for (int i = survivors; i < TEST_CLIENTS; i++)
+    {
+        client_abort(&g_clients[i]);
+    }
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        pthread_join(flooders[i], NULL);
+    }
+
+    for (int i = 0; i < survivors; i++)
     {
-        pthread_mutex_lock(&g_cli_sync_mutex[0]);
-        cli_choice = g_cli_choice;
-        pthread_mutex_unlock(&g_cli_sync_mutex[0]);
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].flood, expected) == 0,
+                    "client %d got %d of %d flood messages", i, g_clients[i].flood, expected);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].order_errors) == 0, "client %d saw out of order messages", i);
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].leaves, TEST_CLIENTS - survivors) == 0,
+                    "client %d saw %d of %d leaves", i, g_clients[i].leaves, TEST_CLIENTS - survivors);
+    }
+    TEST_ASSERT(server_wait_clients(survivors) == 0, "server counts %d clients", server_client_count());
+
+    /* the server still takes new clients after the storm */
+    TEST_ASSERT(client_open(&g_clients[survivors], survivors, port) == 0, "late client could not join");
+    TEST_ASSERT(client_wait(&g_clients[0], &g_clients[0].joins, TEST_CLIENTS + 1) == 0, "late join was not broadcast");
+    client_close(&g_clients[survivors]);
+
+    for (int i = 0; i < survivors; i++)
+    {
+        client_abort(&g_clients[i]);
+    }
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after abort", server_client_count());
+}
+
+static void test_federation(uint16_t port)
+{
+    pthread_t flooders[TEST_SENDERS];
+    FloodArg args[TEST_SENDERS];
+    int expected = TEST_SENDERS * TEST_FLOOD_MSGS;
+    long forwarded;
+
+    /* even clients on this node, odd ones on node 1, node 2 stays empty */
+    (void)port;
+    for (int i = 1; i < TEST_FED_CLIENTS; i += 2)
+    {
+        TEST_ASSERT(client_open(&g_clients[i], i, g_node_ports[1]) == 0, "client %d could not join node 1", i);
+    }
+    TEST_ASSERT(server_wait_peers(TEST_NODES - 1, TEST_FED_CLIENTS / 2) == 0, "node 1 members never reached this node");
+    for (int i = 0; i < TEST_FED_CLIENTS; i += 2)
+    {
+        TEST_ASSERT(client_open(&g_clients[i], i, g_node_ports[0]) == 0, "client %d could not join", i);
+    }
+    TEST_ASSERT(server_wait_clients(TEST_FED_CLIENTS / 2) == 0, "server counts %d clients", server_client_count());
+
+    /* node 1 learns about our members asynchronously, wait until its messages get here */
+    for (int i = 0; i < TEST_TIMEOUT_SEC * 100 && client_counter(&g_clients[0], &g_clients[0].syncs) == 0; i++)
+    {
+        client_send(&g_clients[1], "sync");
+        usleep(10000);
+    }
+    TEST_ASSERT(client_counter(&g_clients[0], &g_clients[0].syncs) > 0, "node 1 never relayed to this node");
+
+    /* senders on both nodes, every client sees every message in per-sender order */
+    forwarded = server_forwarded_count();
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        args[i] = (FloodArg){.client = &g_clients[i], .count = TEST_FLOOD_MSGS};
+        pthread_create(&flooders[i], NULL, client_flooder, &args[i]);
+    }
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        pthread_join(flooders[i], NULL);
+    }
+    for (int i = 0; i < TEST_FED_CLIENTS; i++)
+    {
+        TEST_ASSERT(client_wait(&g_clients[i], &g_clients[i].flood, expected) == 0,
+                    "client %d got %d of %d flood messages", i, g_clients[i].flood, expected);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].order_errors) == 0, "client %d saw out of order messages", i);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].seq_errors) == 0, "client %d saw room seq going back", i);
+        TEST_ASSERT(client_counter(&g_clients[i], &g_clients[i].resends) == 0, "client %d saw a gap", i);
+    }
+
+    /* our half of the flood crossed one link, the empty node got nothing */
+    forwarded = server_forwarded_count() - forwarded;
+    TEST_ASSERT(forwarded == expected / 2, "forwarded %ld messages, expected %d", forwarded, expected / 2);
 
-        switch (cli_choice)
+    for (int i = 0; i < TEST_FED_CLIENTS; i++)
+    {
+        client_send(&g_clients[i], "exit");
+        client_close(&g_clients[i]);
+    }
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after exit", server_client_count());
+}
+
+static void test_shm_ring_full(uint16_t port)
+{
+    ShmRingShared *shared = aligned_alloc(SHM_CACHE_LINE, sizeof(ShmRingShared));
+    RingArg arg = {.total = TEST_RING_BYTES};
+    pthread_t writer;
+    uint8_t buf[TEST_RING_CHUNK];
+    size_t got = 0;
+    int hup[2], bad = 0, stalls = 0;
+    ssize_t n;
+    time_t deadline = time(NULL) + TEST_TIMEOUT_SEC;
+
+    /* a reader that keeps the ring full makes the writer sleep and wake thousands of times, and its own
+     * pauses let the ring run dry too. A lost wakeup stalls one side for good, a 1 s read timeout shows it */
+    (void)port;
+    TEST_ASSERT(shared != NULL && socketpair(AF_UNIX, SOCK_STREAM, 0, hup) == 0, "ring setup failed");
+    if (shared == NULL)
+        return;
+    shm_ring_init(shared);
+    arg.ring = (ShmRing){.shared = shared, .data_efd = eventfd(0, EFD_NONBLOCK), .space_efd = eventfd(0, EFD_NONBLOCK), .hup_fd = hup[0]};
+    pthread_create(&writer, NULL, ring_writer, &arg);
+    for (int k = 0; got < arg.total && time(NULL) < deadline; k++)
+    {
+        if ((n = shm_ring_read(&arg.ring, buf, 1 + (k * 104729) % sizeof(buf), 1000)) < 0)
         {
-        case 1: // 클라이언트 접속을 허용하는 코드를 여기에 작성합니다.
-            fprintf(stdout, "[SERVER] Listening... (New Clients can Join)\n");
-            break;
-        case 2: // 클라이언트가 더이상 접속하지 못하게 하는 코드를 여기에 작성합니다.
-            fprintf(stdout, "[SERVER] New Clients cannot join\n");
-            // pthread_mutex_lock(&g_cli_sync_mutex[1]);
-            pthread_cond_wait(&g_cli_sync_cond, &g_cli_sync_mutex[1]);
-            break;
-        case 3: // Option 3에 대한 코드를 여기에 작성합니다.
-            fprintf(stdout, "[SERVER] Option 3.\n");
-            break;
-        case 4:
-            fprintf(stdout, "[SERVER] Exiting ...\n");
-            break;
-        default:
-            fprintf(stdout, "[SERVER] Invalid OPTION.\n");
-            break;
+            stalls++;
+            continue;
         }
-        sleep(1);
-        if (cli_choice == 4)
-            break;
+        for (ssize_t j = 0; j < n; j++)
+        {
+            bad += (buf[j] != (uint8_t)((got + j) % 251));
+        }
+        got += n;
+        if (k % 16 == 0)
+            usleep(100);
     }
-    pthread_join(cli_tid, NULL);
-    destroy_mutex();
-    return EXIT_SUCCESS;
+    shm_ring_close(&arg.ring); // frees a writer stuck on a lost wakeup
+    pthread_join(writer, NULL);
+    TEST_ASSERT(got == arg.total, "reader got %zu of %zu bytes", got, arg.total);
+    TEST_ASSERT(stalls == 0, "reader stalled %d times with bytes pending", stalls);
+    TEST_ASSERT(bad == 0, "%d bytes came out wrong", bad);
+    close(arg.ring.data_efd);
+    close(arg.ring.space_efd);
+    close(hup[0]);
+    close(hup[1]);
+    free(shared);
 }
 
-void *cli_thread(void *arg)
+static void test_peer_refused(uint16_t port)
 {
-    int cli_choice = 0;
-    show_cli_list();
-    while (1)
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    struct timeval tv = {.tv_sec = TEST_TIMEOUT_SEC};
+    char buf[1024];
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    /* this server has no -p peers, so "<node>;peer" is closed without a membership frame */
+    inet_pton(AF_INET, SERVER_IP, &address.sin_addr);
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    TEST_ASSERT(connect(sockfd, (struct sockaddr *)&address, sizeof(address)) == 0 && recv(sockfd, buf, sizeof(buf), 0) > 0,
+                "intruder got no welcome");
+    TEST_ASSERT(send(sockfd, "intruder;peer", strlen("intruder;peer"), 0) > 0, "intruder could not send its hello");
+    TEST_ASSERT(recv(sockfd, buf, sizeof(buf), 0) == 0, "server kept a link from a node it does not know");
+    close(sockfd);
+    TEST_ASSERT(server_client_count() == 0, "server counts %d clients", server_client_count());
+}
+
+static void test_tls_verify(uint16_t port)
+{
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(server_tls_port())};
+    SSL_CTX *system_ctx = tls_client_ctx(NULL); // the system CA store does not know the throwaway certificate
+    struct timespec start, end;
+    int stalled = socket(AF_INET, SOCK_STREAM, 0);
+
+    TEST_ASSERT(tls_dial(g_client_tls_ctx, SERVER_IP) == 0, "trusted handshake to %s failed", SERVER_IP);
+    TEST_ASSERT(tls_dial(g_client_tls_ctx, "localhost") == 0, "trusted handshake to localhost failed");
+    TEST_ASSERT(tls_dial(g_client_tls_ctx, "127.0.0.2") < 0, "certificate accepted for an address it does not name");
+    TEST_ASSERT(tls_dial(g_client_tls_ctx, "example.com") < 0, "certificate accepted for a name it does not carry");
+    TEST_ASSERT(system_ctx != NULL && tls_dial(system_ctx, SERVER_IP) < 0, "untrusted certificate accepted");
+    SSL_CTX_free(system_ctx);
+
+    /* a client that never says hello holds its own thread, the next one joins right away */
+    inet_pton(AF_INET, SERVER_IP, &address.sin_addr);
+    TEST_ASSERT(connect(stalled, (struct sockaddr *)&address, sizeof(address)) == 0, "stalled client could not connect");
+    usleep(100 * 1000);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    TEST_ASSERT(client_open(&g_clients[1], 1, port) == 0 && client_wait(&g_clients[1], &g_clients[1].joins, 1) == 0,
+                "TLS client did not join behind a stalled handshake");
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    TEST_ASSERT(end.tv_sec - start.tv_sec < TLS_HANDSHAKE_TIMEOUT_SEC, "join waited %ld s for the stalled handshake",
+                (long)(end.tv_sec - start.tv_sec));
+    client_close(&g_clients[1]);
+    TEST_ASSERT(server_wait_clients(0) == 0, "server still counts %d clients", server_client_count());
+    close(stalled);
+}
+
+static void test_ws_protocol(uint16_t port)
+{
+    static const uint8_t mask[4] = {0x37, 0xFA, 0x21, 0x3D};
+    uint8_t frames[1024];
+    char first[80], middle[64];
+    size_t len = 0, frame_len;
+    int one = 1;
+
+    TEST_ASSERT(client_open(&g_clients[0], 0, port) == 0, "client 0 could not join");
+    TEST_ASSERT(client_open(&g_clients[1], 1, port) == 0, "websocket client could not join");
+    TEST_ASSERT(client_wait(&g_clients[0], &g_clients[0].joins, 2) == 0, "websocket join was not broadcast");
+
+    /* one message in three fragments with a ping between them, trickled in odd sized pieces */
+    snprintf(first, sizeof(first), "F 0 0 %0*d", 60, 0);
+    snprintf(middle, sizeof(middle), "%0*d", 50, 0);
+    frame_len = ws_frame_build(frames + len, sizeof(frames) - len, WS_OP_TEXT, first, strlen(first), mask);
+    frames[len] &= 0x7F; // FIN off
+    len += frame_len;
+    len += ws_frame_build(frames + len, sizeof(frames) - len, WS_OP_PING, "hi", 2, mask);
+    frame_len = ws_frame_build(frames + len, sizeof(frames) - len, WS_OP_CONT, middle, strlen(middle), mask);
+    frames[len] &= 0x7F;
+    len += frame_len;
+    len += ws_frame_build(frames + len, sizeof(frames) - len, WS_OP_CONT, "end", 3, mask);
+    setsockopt(g_clients[1].conn.sockfd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    for (size_t sent = 0, piece; sent < len; sent += piece)
+    {
+        piece = 1 + (sent * 13) % 40;
+        piece = (piece < len - sent) ? piece : len - sent;
+        conn_send_all(&g_clients[1].conn, frames + sent, piece);
+        usleep(200);
+    }
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].pongs, 1) == 0, "ping between fragments got no pong");
+    TEST_ASSERT(client_wait(&g_clients[0], &g_clients[0].flood, 1) == 0, "fragmented message never reached client 0");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].flood, 1) == 0, "fragmented message never came back");
+
+    /* an unmasked client frame ends the session with 1002 */
+    conn_send_all(&g_clients[1].conn, frames, ws_frame_build(frames, sizeof(frames), WS_OP_TEXT, "bad", 3, NULL));
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].close_code, WS_CLOSE_PROTOCOL) == 0 &&
+                    client_counter(&g_clients[1], &g_clients[1].close_code) == WS_CLOSE_PROTOCOL,
+                "unmasked frame was closed with %d", client_counter(&g_clients[1], &g_clients[1].close_code));
+    TEST_ASSERT(client_wait(&g_clients[0], &g_clients[0].leaves, 1) == 0, "websocket leave was not broadcast");
+    TEST_ASSERT(server_wait_clients(1) == 0, "server counts %d clients", server_client_count());
+    client_close(&g_clients[1]);
+
+    client_send(&g_clients[0], "exit");
+    client_close(&g_clients[0]);
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after exit", server_client_count());
+}
+
+static void test_ingest(uint16_t port)
+{
+    /* odd clients get messages only, the flood counter says how many of client 0's arrived */
+    TEST_ASSERT(client_open(&g_clients[0], 0, port) == 0, "client 0 could not join");
+    TEST_ASSERT(client_open(&g_clients[1], 1, port) == 0, "client 1 could not join");
+    TEST_ASSERT(client_wait(&g_clients[0], &g_clients[0].joins, 2) == 0, "joins were not broadcast");
+
+    /* a truncated sequence never arrives, control characters vanish from the next message */
+    client_send(&g_clients[0], "F 0 0 caf\xC3");
+    client_send(&g_clients[0], "F 0 1 caf\xC3\xA9\t\x01\x7F\r\n");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].flood, 1) == 0, "clean message never arrived");
+    TEST_ASSERT(client_last_is(&g_clients[1], "F 0 1 caf\xC3\xA9"), "got \"%s\"", g_clients[1].last);
+
+    /* terms loaded while the room is live, case folded for ASCII, UTF-8 terms byte for byte */
+    g_terms_path = TEST_TERMS_PATH;
+    terms_write("# banned\nBadWord\n\xEC\x9A\x95\xEC\x84\xA4\n");
+    TEST_ASSERT(server_terms_reload() == 2, "banned terms were not loaded");
+    client_send(&g_clients[0], "F 0 2 a badword, BADWORDS \xEC\x9A\x95\xEC\x84\xA4!");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].flood, 2) == 0, "censored message never arrived");
+    TEST_ASSERT(client_last_is(&g_clients[1], "F 0 2 a *******, *******S ******!"), "got \"%s\"", g_clients[1].last);
+
+    /* a reload replaces the whole set */
+    terms_write("and\n");
+    TEST_ASSERT(server_terms_reload() == 1, "banned terms were not reloaded");
+    client_send(&g_clients[0], "F 0 3 badword and sand");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].flood, 3) == 0, "message after reload never arrived");
+    TEST_ASSERT(client_last_is(&g_clients[1], "F 0 3 badword *** s***"), "got \"%s\"", g_clients[1].last);
+
+    /* reloads while the receiver scans, each replaced set is freed under it (ASan / TSan builds), seq 0 was dropped */
+    for (int seq = 4; seq < TEST_FLOOD_MSGS; seq++)
+    {
+        char msg[32];
+
+        snprintf(msg, sizeof(msg), "F 0 %d sand", seq);
+        client_send(&g_clients[0], msg);
+        TEST_ASSERT(server_terms_reload() == 1, "banned terms were not reloaded");
+    }
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].flood, TEST_FLOOD_MSGS - 1) == 0, "messages during reloads never arrived");
+    TEST_ASSERT(client_last_is(&g_clients[1], "F 0 49 s***"), "got \"%s\"", g_clients[1].last);
+    g_terms_path = NULL;
+    unlink(TEST_TERMS_PATH);
+
+    /* "exit" with a line ending, the way nc sends it, is still the command */
+    client_send(&g_clients[0], "exit\r\n");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].leaves, 1) == 0, "\"exit\\r\\n\" did not leave");
+    client_close(&g_clients[0]);
+    client_send(&g_clients[1], "exit");
+    client_close(&g_clients[1]);
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after exit", server_client_count());
+}
+
+static void test_legacy(uint16_t port)
+{
+    char buf[1024] = "F 0 0 hi";
+    int sockfd;
+
+    TEST_ASSERT(client_open(&g_clients[1], 1, port) == 0, "client 1 could not join");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].joins, 1) == 0, "client 1 missed its own join");
+
+    /* the original client : a bare nickname, then whole NUL padded 1024 byte buffers */
+    TEST_ASSERT((sockfd = legacy_open(port, "legacy")) >= 0, "legacy client could not connect");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].joins, 2) == 0, "legacy client did not join");
+
+    /* everything after the first NUL is padding, whatever it holds */
+    memcpy(buf + strlen(buf) + 1, "lo world", strlen("lo world"));
+    TEST_ASSERT(send(sockfd, buf, sizeof(buf), 0) == sizeof(buf), "legacy client could not send");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].flood, 1) == 0, "legacy message never arrived");
+    TEST_ASSERT(client_last_is(&g_clients[1], "F 0 0 hi"), "got \"%s\"", g_clients[1].last);
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, "exit", strlen("exit"));
+    memset(buf + 8, 'x', 32);
+    TEST_ASSERT(send(sockfd, buf, sizeof(buf), 0) == sizeof(buf), "legacy client could not send exit");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].leaves, 1) == 0, "NUL padded \"exit\" did not leave");
+    close(sockfd);
+    client_send(&g_clients[1], "exit");
+    client_close(&g_clients[1]);
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after exit", server_client_count());
+}
+
+static void test_nickname(uint16_t port)
+{
+    int watcher, named, banned, refused;
+
+    /* legacy clients see the room as plain text, so the watcher reads the nicknames as the server keeps them */
+    TEST_ASSERT((watcher = legacy_open(port, "watcher")) >= 0 && legacy_expect(watcher, "(USER NAME : watcher) is joined") == 0,
+                "watcher did not join");
+
+    /* control characters go, then 19 bytes without splitting a character : "t" and six of the seven "가" */
+    TEST_ASSERT((named = legacy_open(port, "t\x01\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80")) >= 0 &&
+                    legacy_expect(watcher, "(USER NAME : t\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80\xEA\xB0\x80) is joined") == 0,
+                "long nickname was not clipped on a character boundary");
+
+    /* banned terms are censored in names too */
+    g_terms_path = TEST_TERMS_PATH;
+    terms_write("badword\n");
+    TEST_ASSERT(server_terms_reload() == 1, "banned terms were not loaded");
+    TEST_ASSERT((banned = legacy_open(port, "BadWord1")) >= 0 && legacy_expect(watcher, "(USER NAME : *******1) is joined") == 0,
+                "banned term in a nickname was not censored");
+    g_terms_path = NULL;
+    unlink(TEST_TERMS_PATH);
+
+    /* invalid UTF-8, or nothing left after the controls, is refused with a notice */
+    TEST_ASSERT((refused = legacy_open(port, "bad\xFF")) >= 0 && legacy_expect(refused, "Nickname must be valid UTF-8") == 0 &&
+                    legacy_expect(refused, "never") < 0,
+                "invalid UTF-8 nickname was not refused");
+    close(refused);
+    TEST_ASSERT((refused = legacy_open(port, "\x01\x02")) >= 0 && legacy_expect(refused, "Nickname must be valid UTF-8") == 0,
+                "nickname of control characters only was not refused");
+    close(refused);
+    TEST_ASSERT(server_client_count() == 3, "server counts %d clients", server_client_count());
+
+    close(banned);
+    close(named);
+    close(watcher);
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after close", server_client_count());
+}
+
+static void test_peer_ingest(uint16_t port)
+{
+    static const char *relayed[] = {
+        "evil\0F 0 0 bad \xFF",   // invalid UTF-8
+        "ev\xFFil\0F 0 1 ok",     // invalid nickname
+        "\x01\0F 0 2 ok",         // nothing left of the nickname
+        "evil\0exit",              // a command is not a message
+        "ev\x01il\0F 0 3 ok\x07", // controls stripped from both
+    };
+    static const size_t relayed_len[] = {16, 14, 10, 9, 15};
+    uint8_t frame[FRAME_MAX_SIZE];
+    int sockfd;
+
+    /* 127.0.0.1 is a configured peer, nothing has to listen there : a node from it without the secret is refused */
+    TEST_ASSERT(server_peer_add(SERVER_IP, 1) == 0, "peer was not configured");
+    TEST_ASSERT((sockfd = peer_open(port, "evil", "not-the-secret")) >= 0, "node got no challenge");
+    TEST_ASSERT(recv(sockfd, frame, sizeof(frame), 0) == 0, "server kept a link that failed the challenge");
+    close(sockfd);
+
+    /* with it, the node may link in but is still no more trusted than a client */
+    TEST_ASSERT(client_open(&g_clients[1], 1, port) == 0, "client 1 could not join");
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].joins, 1) == 0, "client 1 missed its own join");
+    TEST_ASSERT((sockfd = peer_open(port, "evil", TEST_PEER_SECRET)) >= 0, "node could not link in");
+    usleep(100 * 1000);
+    for (size_t i = 0; i < sizeof(relayed) / sizeof(relayed[0]); i++)
     {
-        int continue_flag = 0;
-        scanf("%d", &cli_choice);
+        TEST_ASSERT(send(sockfd, frame, frame_build(frame, sizeof(frame), FRAME_PEER_MSG, 0, CODEC_PLAIN, NULL, relayed[i], relayed_len[i]), 0) > 0,
+                    "node could not relay message %zu", i);
+    }
+    TEST_ASSERT(client_wait(&g_clients[1], &g_clients[1].flood, 1) == 0, "clean relayed message never arrived");
+    TEST_ASSERT(client_last_is(&g_clients[1], "F 0 3 ok") && client_counter(&g_clients[1], &g_clients[1].flood) == 1,
+                "relayed messages were not ingested, last \"%s\"", g_clients[1].last);
+    close(sockfd);
+    client_send(&g_clients[1], "exit");
+    client_close(&g_clients[1]);
+    TEST_ASSERT(server_wait_clients(0) == 0, "server counts %d clients after exit", server_client_count());
+}
+
+static int legacy_open(uint16_t port, const char *hello) // a raw client of the original protocol, returns its socket or -1
+{
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(port)};
+    struct timeval tv = {.tv_sec = TEST_TIMEOUT_SEC};
+    char welcome[64];
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    inet_pton(AF_INET, SERVER_IP, &address.sin_addr);
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (sockfd < 0 || connect(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        recv(sockfd, welcome, sizeof(welcome), 0) <= 0 || send(sockfd, hello, strlen(hello), 0) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static int peer_open(uint16_t port, const char *node, const char *secret) // a raw node link that answers the challenge, -1 : no challenge
+{
+    char hello[HANDSHAKE_BUF_SIZE], nonce[HANDSHAKE_BUF_SIZE], proof[HANDSHAKE_PROOF_LEN * 2 + 1];
+    ssize_t nonce_len;
+    int sockfd;
+
+    snprintf(hello, sizeof(hello), "%s%c%s", node, HANDSHAKE_CODEC_SEP, HANDSHAKE_PEER);
+    if ((sockfd = legacy_open(port, hello)) < 0)
+        return -1;
+    if ((nonce_len = recv(sockfd, nonce, sizeof(nonce) - 1, 0)) <= 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    nonce[nonce_len] = '\0';
+    if (handshake_peer_proof(secret, nonce, node, proof, sizeof(proof)) < 0 || send(sockfd, proof, strlen(proof), 0) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    return sockfd;
+}
+
+static int legacy_expect(int sockfd, const char *text) // reads the plain text stream until text shows up, -1 : closed or timed out
+{
+    char buf[8192];
+    size_t len = 0, keep = strlen(text);
+    ssize_t n;
 
-        if (g_cli_choice == cli_choice)
+    while ((n = recv(sockfd, buf + len, sizeof(buf) - 1 - len, 0)) > 0)
+    {
+        len += n;
+        buf[len] = '\0';
+        if (strstr(buf, text) != NULL)
+            return 0;
+        if (len > keep && len >= sizeof(buf) - 1) // full, keep a tail that may start the text
         {
-            fprintf(stdout, "\n========================================\n");
-            fprintf(stdout, "[SERVER_CLI] You selected same option. Please try other Option.\n");
-            fprintf(stdout, "========================================\n\n");
-            continue;
+            memmove(buf, buf + len - keep, keep);
+            len = keep;
         }
+    }
+    return -1;
+}
 
-        switch (cli_choice)
+static void terms_write(const char *terms)
+{
+    FILE *fp = fopen(TEST_TERMS_PATH, "w");
+
+    if (fp == NULL)
+        return;
+    fputs(terms, fp);
+    fclose(fp);
+}
+
+static int client_last_is(TestClient *c, const char *expected)
+{
+    int same;
+    pthread_mutex_lock(&c->mutex);
+    same = (strcmp(c->last, expected) == 0);
+    pthread_mutex_unlock(&c->mutex);
+    return same;
+}
+
+void *ring_writer(void *arg) // writes arg->total bytes of a position pattern in odd sized chunks
+{
+    RingArg *ring_arg = (RingArg *)arg;
+    uint8_t chunk[TEST_RING_CHUNK];
+    size_t sent = 0, n;
+
+    for (int k = 0; sent < ring_arg->total; k++)
+    {
+        n = 1 + (k * 7919) % sizeof(chunk);
+        n = (n < ring_arg->total - sent) ? n : ring_arg->total - sent;
+        for (size_t j = 0; j < n; j++)
         {
-        case 0:
-            fprintf(stdout, "\n========================================\n");
-            fprintf(stdout, "[SERVER_CLI] You selected Help Option.\n");
-            fprintf(stdout, "========================================\n\n");
-            show_cli_list();
-            continue_flag = 1;
-            break;
-        case 1:
-            fprintf(stdout, "\n========================================\n");
-            fprintf(stdout, "[SERVER_CLI] Option 1 : Socket Server Opened.\n");
-            fprintf(stdout, "[SERVER_CLI] Now Socket Server Will Spawn Client Threads.\n");
-            fprintf(stdout, "========================================\n\n");
-            break;
-        case 2:
-            fprintf(stdout, "\n========================================\n");
-            fprintf(stdout, "[SERVER_CLI] Option 2 : Socket Server Closed.\n");
-            fprintf(stdout, "[SERVER_CLI] Now Socket Server will not spawn another Client.\n");
-            fprintf(stdout, "========================================\n\n");
-            break;
-        case 3:
-            fprintf(stdout, "\n========================================\n");
-            fprintf(stdout, "[SERVER_CLI] Option 3.\n");
-            fprintf(stdout, "========================================\n\n");
-            break;
-        case 4:
-            fprintf(stdout, "\n========================================\n");
-            fprintf(stdout, "[SERVER_CLI] You selected Exit Option.\n");
-            fprintf(stdout, "========================================\n\n");
-            break;
-        default:
-            fprintf(stdout, "\n========================================\n");
-            fprintf(stdout, "[SERVER_CLI] You selected Invalid Option. Please try other Option\n");
-            fprintf(stdout, "========================================\n\n");
-            show_cli_list();
-            continue_flag = 1;
+            chunk[j] = (uint8_t)((sent + j) % 251);
+        }
+        if (shm_ring_write(&ring_arg->ring, chunk, n) < 0)
             break;
+        sent += n;
+        if (k % 64 == 0)
+            usleep(100);
+    }
+    return NULL;
+}
+
+/* Node Functions */
+static int node_spawn() // forks nodes 1 .. TEST_NODES - 1, they wait in node_main() for federation cases
+{
+    int to_node[2], from_node[2];
+
+    for (int n = 1; n < TEST_NODES; n++)
+    {
+        if (pipe(to_node) < 0 || pipe(from_node) < 0 || (g_node_pids[n] = fork()) < 0)
+            return -1;
+        if (g_node_pids[n] == 0)
+        {
+            close(to_node[1]);
+            close(from_node[0]);
+            for (int k = 1; k < n; k++) // the older nodes' pipes belong to the parent
+            {
+                close(g_node_pipes[k][0]);
+                close(g_node_pipes[k][1]);
+            }
+            node_main(n, to_node[0], from_node[1]);
         }
+        close(to_node[0]);
+        close(from_node[1]);
+        g_node_pipes[n][0] = from_node[0];
+        g_node_pipes[n][1] = to_node[1];
+    }
+    return 0;
+}
+
+/* one server per NodeConfig read from cmd_fd : replies its port, reads the ports of all nodes,
+ * serves until a byte arrives, then replies 0 once it stopped. EOF on cmd_fd ends the node */
+static void node_main(int n, int cmd_fd, int reply_fd)
+{
+    NodeConfig config;
+    uint16_t ports[TEST_NODES];
+    int port;
+    char c;
 
-        if (continue_flag == 1)
+    while (read(cmd_fd, &config, sizeof(config)) == sizeof(config))
+    {
+        g_batch_window_us = config.batch_window_us;
+        g_batch_max_msgs = config.batch_max_msgs;
+        g_drop_oldest = config.drop_oldest;
+        port = server_start(0);
+        if (write(reply_fd, &port, sizeof(port)) != sizeof(port) || port < 0)
+            _exit(EXIT_FAILURE);
+        if (read(cmd_fd, ports, sizeof(ports)) == (ssize_t)sizeof(ports))
         {
-            continue;
+            for (int k = 0; k < TEST_NODES; k++)
+            {
+                if (k != n)
+                    server_peer_add(SERVER_IP, ports[k]);
+            }
         }
+        while (read(cmd_fd, &c, 1) < 0 && errno == EINTR) // a byte or EOF : the test is over
+            ;
+        server_stop();
+        c = 0;
+        if (write(reply_fd, &c, 1) != 1)
+            _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static int node_start(const NodeConfig *config, int nodes) // nodes 1 .. nodes - 1 start a server, g_node_ports gets their ports
+{
+    int port;
+
+    for (int n = 1; n < nodes; n++)
+    {
+        if (write(g_node_pipes[n][1], config, sizeof(*config)) != sizeof(*config) ||
+            read(g_node_pipes[n][0], &port, sizeof(port)) != sizeof(port) || port < 0)
+            return -1;
+        g_node_ports[n] = port;
+    }
+    return 0;
+}
+
+static void node_link(uint16_t port, int nodes) // full mesh : every node dials every other node
+{
+    g_node_ports[0] = port;
+    for (int n = 1; n < nodes; n++)
+    {
+        if (write(g_node_pipes[n][1], g_node_ports, sizeof(g_node_ports)) < 0)
+            fprintf(g_log, "[TEST] node %d did not get its peers\n", n);
+        server_peer_add(SERVER_IP, g_node_ports[n]);
+    }
+}
+
+static void node_stop(int nodes)
+{
+    char c = 1;
+
+    for (int n = 1; n < nodes; n++)
+    {
+        TEST_ASSERT(write(g_node_pipes[n][1], &c, 1) == 1, "node %d was not told to stop", n);
+    }
+    for (int n = 1; n < nodes; n++)
+    {
+        TEST_ASSERT(read(g_node_pipes[n][0], &c, 1) == 1 && c == 0, "node %d did not stop cleanly", n);
+    }
+}
+
+static void node_reap()
+{
+    int status;
+
+    for (int n = 1; n < TEST_NODES; n++)
+    {
+        close(g_node_pipes[n][1]);
+        close(g_node_pipes[n][0]);
+    }
+    for (int n = 1; n < TEST_NODES; n++)
+    {
+        TEST_ASSERT(waitpid(g_node_pids[n], &status, 0) == g_node_pids[n] && WIFEXITED(status) &&
+                        WEXITSTATUS(status) == EXIT_SUCCESS,
+                    "node %d did not exit cleanly", n);
+    }
+}
+
+/* Client Functions */
+static int client_open(TestClient *c, int id, uint16_t port)
+{
+    int sockfd, tls;
+    char buf[1024];
+    struct sockaddr_in server_address = {.sin_family = AF_INET, .sin_port = htons(port)};
 
-        pthread_mutex_lock(&g_cli_sync_mutex[0]);
-        g_cli_choice = cli_choice;
-        pthread_mutex_unlock(&g_cli_sync_mutex[0]);
+    memset(c, 0, sizeof(*c));
+    c->id = id;
+    c->codec = (id % 2 == 0) ? CODEC_PLAIN : CODEC_DEFLATE; // both shared frame paths get traffic
+    for (int i = 0; i < TEST_SENDERS; i++)
+    {
+        c->last_seq[i] = -1;
+    }
+    pthread_mutex_init(&c->mutex, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    pthread_mutex_init(&c->send_mut, NULL);
 
-        if (g_cli_choice == 1 || g_cli_choice == 4)
+    if (g_local_path != NULL && id % 2 == 1)
+    {
+        if (conn_local_connect(&c->conn, g_local_path, buf, sizeof(buf)) <= 0)
+            return -1;
+    }
+    else if (g_ws_gateway && id % 2 == 1) // upgrade, welcome text, then the nickname as the first message
+    {
+        inet_pton(AF_INET, SERVER_IP, &(server_address.sin_addr));
+        if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0 || (c->ws = malloc(sizeof(WsParser))) == NULL)
+            return -1;
+        conn_tcp(&c->conn, sockfd);
+        ws_parser_init(c->ws, 0);
+        if (connect(sockfd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0 ||
+            ws_connect(c->ws, sockfd, SERVER_IP) < 0 || ws_read(c->ws, &c->conn) != WS_OP_TEXT)
         {
-            pthread_mutex_lock(&g_cli_sync_mutex[1]);
-            pthread_cond_signal(&g_cli_sync_cond);
-            pthread_mutex_unlock(&g_cli_sync_mutex[1]);
+            conn_close(&c->conn);
+            free(c->ws);
+            c->ws = NULL;
+            return -1;
         }
+        snprintf(buf, sizeof(buf), "t%d", id);
+        client_send(c, buf);
+        return pthread_create(&c->tid, NULL, client_reader, c);
+    }
+    else
+    {
+        tls = (server_tls_port() >= 0 && id % 2 == 1);
+        server_address.sin_port = htons(tls ? server_tls_port() : port);
+        inet_pton(AF_INET, SERVER_IP, &(server_address.sin_addr));
+        if ((sockfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+            return -1;
+        conn_tcp(&c->conn, sockfd);
+        if (connect(sockfd, (struct sockaddr *)&server_address, sizeof(server_address)) < 0 ||
+            (tls && conn_tls(&c->conn, sockfd, g_client_tls_ctx, SERVER_IP) < 0))
+        {
+            close(sockfd);
+            return -1;
+        }
+        if (conn_hello_recv(&c->conn, buf, sizeof(buf)) <= 0)
+        {
+            conn_close(&c->conn);
+            return -1;
+        }
+    }
+    snprintf(buf, sizeof(buf), "t%d%c%s", id, HANDSHAKE_CODEC_SEP, codec_name(c->codec));
+    conn_hello_send(&c->conn, buf, strlen(buf));
+    return pthread_create(&c->tid, NULL, client_reader, c);
+}
+
+static void client_send(TestClient *c, const char *msg)
+{
+    uint8_t frame[FRAME_MAX_SIZE];
+    uint32_t mask;
+    pthread_mutex_lock(&c->send_mut);
+    if (c->ws != NULL)
+    {
+        mask = (uint32_t)c->id * 2654435761u + ++c->ws_frames * 40503u;
+        conn_send_all(&c->conn, frame, ws_frame_build(frame, sizeof(frame), WS_OP_TEXT, msg, strlen(msg), (uint8_t *)&mask));
+    }
+    else
+        conn_send_all(&c->conn, frame, frame_build(frame, sizeof(frame), FRAME_CHAT, 0, CODEC_PLAIN, NULL, msg, strlen(msg)));
+    pthread_mutex_unlock(&c->send_mut);
+}
 
-        if (g_cli_choice == 4)
+static void client_abort(TestClient *c) // RST instead of a clean close, a local client just vanishes
+{
+    struct linger lg = {.l_onoff = 1, .l_linger = 0};
+    setsockopt(c->conn.sockfd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+    client_close(c);
+}
+
+static void client_close(TestClient *c)
+{
+    conn_shutdown(&c->conn, SHUT_RD); // wakes client_reader
+    pthread_join(c->tid, NULL);
+    conn_close(&c->conn);
+    free(c->ws);
+    pthread_mutex_destroy(&c->mutex);
+    pthread_cond_destroy(&c->cond);
+    pthread_mutex_destroy(&c->send_mut);
+}
+
+static int client_wait(TestClient *c, const int *counter, int expected) // 0 once *counter reaches expected
+{
+    struct timespec deadline;
+    int ret = 0;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += TEST_TIMEOUT_SEC;
+    pthread_mutex_lock(&c->mutex);
+    while (*counter < expected && ret != ETIMEDOUT)
+    {
+        ret = pthread_cond_timedwait(&c->cond, &c->mutex, &deadline);
+    }
+    ret = (*counter >= expected) ? 0 : -1;
+    pthread_mutex_unlock(&c->mutex);
+    return ret;
+}
+
+static int client_counter(TestClient *c, const int *counter) // reads a counter client_reader updates
+{
+    int value;
+    pthread_mutex_lock(&c->mutex);
+    value = *counter;
+    pthread_mutex_unlock(&c->mutex);
+    return value;
+}
+
+static int server_wait_clients(int expected)
+{
+    for (int i = 0; i < TEST_TIMEOUT_SEC * 1000; i++)
+    {
+        if (server_client_count() == expected)
+            return 0;
+        usleep(1000);
+    }
+    return -1;
+}
+
+static int tls_dial(SSL_CTX *ctx, const char *host) // a bare handshake to the server's TLS port, 0 : host was verified
+{
+    struct sockaddr_in address = {.sin_family = AF_INET, .sin_port = htons(server_tls_port())};
+    Conn conn;
+    int sockfd = socket(AF_INET, SOCK_STREAM, 0);
+
+    inet_pton(AF_INET, SERVER_IP, &address.sin_addr);
+    if (sockfd < 0 || connect(sockfd, (struct sockaddr *)&address, sizeof(address)) < 0 || conn_tls(&conn, sockfd, ctx, host) < 0)
+    {
+        close(sockfd);
+        return -1;
+    }
+    conn_close(&conn);
+    return 0;
+}
+
+static int server_wait_peers(int links, int members) // 0 once the links are up and report that many members
+{
+    int now_members;
+
+    for (int i = 0; i < TEST_TIMEOUT_SEC * 1000; i++)
+    {
+        if (server_peer_links(&now_members) == links && now_members == members)
+            return 0;
+        usleep(1000);
+    }
+    return -1;
+}
+
+void *client_reader(void *arg)
+{
+    TestClient *c = (TestClient *)arg;
+    uint8_t payload[FRAME_MAX_PAYLOAD];
+    uint8_t resend[FRAME_HEADER_SIZE + 8];
+    char text[MESSAGE_MAX_LEN + 1];
+    z_stream inflate_stream = {0};
+    FrameHeader hdr;
+    char *body;
+    int sender, seq, live;
+
+    inflateInit(&inflate_stream);
+    while (1)
+    {
+        if (c->ws != NULL) // text frames carry no room seq, live order is all there is
+        {
+            int opcode = ws_read(c->ws, &c->conn);
+
+            if (opcode == WS_OP_PONG || opcode == WS_OP_CLOSE)
+            {
+                pthread_mutex_lock(&c->mutex);
+                if (opcode == WS_OP_PONG)
+                    c->pongs++;
+                else
+                    c->close_code = (c->ws->ctl_len >= 2) ? (c->ws->ctl[0] << 8) | c->ws->ctl[1] : WS_CLOSE_NORMAL;
+                pthread_cond_broadcast(&c->cond);
+                pthread_mutex_unlock(&c->mutex);
+                if (opcode == WS_OP_CLOSE)
+                    break;
+                continue;
+            }
+            if (opcode != WS_OP_TEXT)
+                break;
+            snprintf(text, sizeof(text), "%s", (char *)c->ws->msg);
+            hdr = (FrameHeader){.type = FRAME_CHAT, .seq = 0};
+        }
+        else if (conn_frame_read(&c->conn, &hdr, payload, sizeof(payload)) <= 0)
             break;
+        else if (frame_decode(&hdr, &inflate_stream, payload, text, sizeof(text)) < 0)
+            continue;
+        if ((body = strstr(text, ") ")) == NULL)
+            continue;
+        body += 2;
+        live = (hdr.type == FRAME_CHAT);
+
+        pthread_mutex_lock(&c->mutex);
+        snprintf(c->last, sizeof(c->last), "%s", body);
+        if (live && hdr.seq != 0)
+        {
+            if (hdr.seq <= c->room_seq)
+                c->seq_errors++;
+            else if (c->room_seq != 0 && hdr.seq > c->room_seq + 1)
+            {
+                pthread_mutex_lock(&c->send_mut);
+                conn_send_all(&c->conn, resend, frame_build_resend(resend, sizeof(resend), c->room_seq + 1, hdr.seq - 1));
+                pthread_mutex_unlock(&c->send_mut);
+                c->resends++;
+            }
+            if (hdr.seq > c->room_seq)
+                c->room_seq = hdr.seq;
+        }
+        if (strcmp(body, "is joined to chat.") == 0)
+        {
+            c->joins++;
+        }
+        else if (strcmp(body, "has left chat.") == 0)
+        {
+            c->leaves++;
+        }
+        else if (strcmp(body, "sync") == 0)
+        {
+            c->syncs++;
+        }
+        else if (sscanf(body, "F %d %d", &sender, &seq) == 2 && sender >= 0 && sender < TEST_SENDERS &&
+                 seq >= 0 && seq < TEST_FLOOD_MSGS)
+        {
+            if (c->seen[sender][seq] || (live && seq <= c->last_seq[sender]))
+                c->order_errors++;
+            if (live)
+                c->last_seq[sender] = seq;
+            if (!c->seen[sender][seq])
+                c->flood++;
+            c->seen[sender][seq] = 1;
+        }
+        pthread_cond_broadcast(&c->cond);
+        pthread_mutex_unlock(&c->mutex);
     }
-    fprintf(stdout, "[SERVER] Exiting CLI thread.\n");
+    inflateEnd(&inflate_stream);
     pthread_exit(NULL);
-}
\ No newline at end of file
+}
+
+void *client_flooder(void *arg)
+{
+    FloodArg *f = (FloodArg *)arg;
+    char msg[256];
+
+    for (int seq = 0; seq < f->count; seq++)
+    {
+        // odd sequence numbers carry a long tail so deflate clients see compressed frames too
+        int len = snprintf(msg, sizeof(msg), "F %d %d ", f->client->id, seq);
+        for (; seq % 2 == 1 && len < 200; len++)
+        {
+            msg[len] = 'a' + len % 4;
+        }
+        msg[len] = '\0';
+        client_send(f->client, msg);
+    }
+    pthread_exit(NULL);
+}
@@ -0,0 +1,204 @@
+/***
+ * @file tls.c
+ * @brief TLS 1.3 handshake in user space, records offloaded to the kernel (kTLS) when it can
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ *
+ * The contexts ask OpenSSL for kTLS (SSL_OP_ENABLE_KTLS) : once the
+ * handshake is done OpenSSL itself moves the record keys into the socket
+ * when the kernel has the tls module and the suite is one it offloads,
+ * and keeps the records in user space otherwise. Both cases go on through
+ * SSL_read / SSL_write, so the sequence numbers, key updates and tickets
+ * stay OpenSSL's business. Clients always verify the server certificate
+ * against the host they dialled.
+ */
+
+/* HEADERS */
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <openssl/bio.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include "tls.h"
+
+/* DEFINE */
+#define TLS_CERT_DAYS 30 /* the throwaway self-signed certificate */
+#define TLS_CERT_SAN "DNS:localhost,IP:127.0.0.1"
+
+/* FUNCTIONS */
+static SSL_CTX *tls_ctx_new(const SSL_METHOD *method);
+static int tls_self_signed(X509 **cert_out, EVP_PKEY **pkey_out);
+static int tls_verify_host(SSL *ssl, const char *host);
+static void tls_handshake_timeout(int sockfd, int sec);
+
+/* Context Functions */
+SSL_CTX *tls_server_ctx(const char *cert_path, const char *key_path) // NULL paths : throwaway self-signed certificate
+{
+    SSL_CTX *ctx = tls_ctx_new(TLS_server_method());
+    X509 *cert = NULL;
+    EVP_PKEY *pkey = NULL;
+    int ok = 0;
+
+    if (ctx == NULL)
+        return NULL;
+    SSL_CTX_set_num_tickets(ctx, 0); // clients never resume, and a ticket write ahead of the welcome stalls it behind Nagle
+    if (cert_path != NULL && key_path != NULL)
+        ok = SSL_CTX_use_certificate_chain_file(ctx, cert_path) == 1 &&
+             SSL_CTX_use_PrivateKey_file(ctx, key_path, SSL_FILETYPE_PEM) == 1 && SSL_CTX_check_private_key(ctx) == 1;
+    else if (tls_self_signed(&cert, &pkey) == 0)
+        ok = SSL_CTX_use_certificate(ctx, cert) == 1 && SSL_CTX_use_PrivateKey(ctx, pkey) == 1;
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    if (ok)
+        return ctx;
+    SSL_CTX_free(ctx);
+    return NULL;
+}
+
+SSL_CTX *tls_client_ctx(const char *ca_path) // NULL : the system CA store, the server certificate is always verified
+{
+    SSL_CTX *ctx = tls_ctx_new(TLS_client_method());
+
+    if (ctx == NULL)
+        return NULL;
+    if ((ca_path != NULL) ? SSL_CTX_load_verify_locations(ctx, ca_path, NULL) != 1 : SSL_CTX_set_default_verify_paths(ctx) != 1)
+    {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, NULL);
+    return ctx;
+}
+
+static SSL_CTX *tls_ctx_new(const SSL_METHOD *method)
+{
+    SSL_CTX *ctx;
+
+    if ((ctx = SSL_CTX_new(method)) == NULL)
+        return NULL;
+    if (SSL_CTX_set_min_proto_version(ctx, TLS1_3_VERSION) != 1 || SSL_CTX_set_ciphersuites(ctx, TLS_CIPHERSUITE) != 1)
+    {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS | SSL_OP_IGNORE_UNEXPECTED_EOF); // a peer may just close, no close_notify
+    SSL_CTX_set_mode(ctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    return ctx;
+}
+
+static int tls_self_signed(X509 **cert_out, EVP_PKEY **pkey_out) // P-256, valid for localhost and 127.0.0.1
+{
+    EVP_PKEY *pkey = EVP_EC_gen("P-256");
+    X509 *cert = X509_new();
+    X509_NAME *name;
+    X509_EXTENSION *san = NULL;
+    X509V3_CTX v3;
+
+    if (pkey == NULL || cert == NULL)
+        goto fail;
+    X509_set_version(cert, 2);
+    ASN1_INTEGER_set(X509_get_serialNumber(cert), 1);
+    X509_gmtime_adj(X509_getm_notBefore(cert), 0);
+    X509_gmtime_adj(X509_getm_notAfter(cert), 60L * 60 * 24 * TLS_CERT_DAYS);
+    name = X509_get_subject_name(cert);
+    X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC, (const unsigned char *)"localhost", -1, -1, 0);
+    X509_set_issuer_name(cert, name);
+    X509V3_set_ctx(&v3, cert, cert, NULL, NULL, 0);
+    if ((san = X509V3_EXT_conf_nid(NULL, &v3, NID_subject_alt_name, TLS_CERT_SAN)) == NULL || X509_add_ext(cert, san, -1) != 1 ||
+        X509_set_pubkey(cert, pkey) != 1 || X509_sign(cert, pkey, EVP_sha256()) <= 0)
+        goto fail;
+    X509_EXTENSION_free(san);
+    *cert_out = cert;
+    *pkey_out = pkey;
+    return 0;
+
+fail:
+    X509_EXTENSION_free(san);
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    return -1;
+}
+
+/* writes a throwaway self-signed certificate and its key as PEM, the certificate is its own CA file for clients */
+int tls_cert_write(const char *cert_path, const char *key_path)
+{
+    X509 *cert;
+    EVP_PKEY *pkey;
+    FILE *cert_fp = NULL, *key_fp = NULL;
+    int ret = -1;
+
+    if (tls_self_signed(&cert, &pkey) < 0)
+        return -1;
+    if ((cert_fp = fopen(cert_path, "w")) != NULL && (key_fp = fopen(key_path, "w")) != NULL &&
+        PEM_write_X509(cert_fp, cert) == 1 && PEM_write_PrivateKey(key_fp, pkey, NULL, NULL, 0, NULL, NULL) == 1)
+        ret = 0;
+    if (cert_fp != NULL && fclose(cert_fp) != 0)
+        ret = -1;
+    if (key_fp != NULL && fclose(key_fp) != 0)
+        ret = -1;
+    X509_free(cert);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+
+/* Session Functions */
+/* handshakes on the blocking sockfd, host NULL : server side, otherwise the name or address the client dialled */
+int tls_start(SSL_CTX *ctx, int sockfd, const char *host, SSL **ssl_out)
+{
+    SSL *ssl;
+    int ret = TLS_START_FAILED;
+
+    *ssl_out = NULL;
+    if ((ssl = SSL_new(ctx)) == NULL)
+        return TLS_START_FAILED;
+    tls_handshake_timeout(sockfd, TLS_HANDSHAKE_TIMEOUT_SEC);
+    if (SSL_set_fd(ssl, sockfd) == 1 && (host == NULL || tls_verify_host(ssl, host) == 0) &&
+        ((host == NULL) ? SSL_accept(ssl) : SSL_connect(ssl)) == 1)
+    {
+        tls_handshake_timeout(sockfd, 0);
+        ret = tls_kernel_records(ssl);
+    }
+    if (ret == TLS_START_FAILED)
+        SSL_free(ssl);
+    else
+        *ssl_out = ssl;
+    return ret;
+}
+
+int tls_kernel_records(SSL *ssl) // TLS_KTLS_TX | TLS_KTLS_RX, the directions OpenSSL moved into the socket
+{
+    return (BIO_get_ktls_send(SSL_get_wbio(ssl)) ? TLS_KTLS_TX : 0) | (BIO_get_ktls_recv(SSL_get_rbio(ssl)) ? TLS_KTLS_RX : 0);
+}
+
+const char *tls_records_name(SSL *ssl) // for logs, where the records of each direction are done
+{
+    static const char *names[] = {"user space", "kTLS tx", "kTLS rx", "kTLS tx+rx"};
+
+    return names[tls_kernel_records(ssl)];
+}
+
+static int tls_verify_host(SSL *ssl, const char *host) // the certificate must name host, an IP address or a DNS name
+{
+    struct in6_addr addr;
+
+    if (inet_pton(AF_INET, host, &addr) == 1 || inet_pton(AF_INET6, host, &addr) == 1)
+        return (X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(ssl), host) == 1) ? 0 : -1;
+    if (SSL_set1_host(ssl, host) != 1 || SSL_set_tlsext_host_name(ssl, host) != 1) // SNI for name based servers
+        return -1;
+    return 0;
+}
+
+static void tls_handshake_timeout(int sockfd, int sec) // 0 : back to blocking without a timeout
+{
+    struct timeval tv = {.tv_sec = sec};
+
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
@@ -0,0 +1,38 @@
+/***
+ * @file tls.h
+ * @brief TLS 1.3 handshake in user space, records offloaded to the kernel (kTLS) when it can
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+#ifndef TLS_H
+#define TLS_H
+
+/* HEADERS */
+#include <openssl/ssl.h>
+
+/* DEFINE */
+#define TLS_HANDSHAKE_TIMEOUT_SEC 5 /* a stalled handshake must not hold an accept loop forever */
+#define TLS_CIPHERSUITE "TLS_AES_128_GCM_SHA256" /* the suite every kTLS kernel offloads */
+
+enum
+{
+    TLS_START_FAILED = -1 /* otherwise tls_start() returns tls_kernel_records() */
+};
+
+/* record directions OpenSSL handed to the kernel (kTLS), still used through SSL_read / SSL_write, 0 : all in user space */
+enum
+{
+    TLS_KTLS_TX = 1,
+    TLS_KTLS_RX = 2 /* OpenSSL 3.0 offloads TLS 1.3 receive nowhere, so tx alone is the usual kTLS */
+};
+
+/* FUNCTIONS */
+SSL_CTX *tls_server_ctx(const char *cert_path, const char *key_path);
+SSL_CTX *tls_client_ctx(const char *ca_path);
+int tls_cert_write(const char *cert_path, const char *key_path);
+int tls_start(SSL_CTX *ctx, int sockfd, const char *host, SSL **ssl_out);
+int tls_kernel_records(SSL *ssl);
+const char *tls_records_name(SSL *ssl);
+
+#endif
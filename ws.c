@@ -0,0 +1,462 @@
+/***
+ * @file ws.c
+ * @brief WebSocket (RFC 6455) gateway : upgrade handshake, incremental frame parser, SIMD unmasking
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ *
+ * Web clients connect to the same listener as native ones. A native client
+ * waits for the welcome message, a browser speaks first with an HTTP GET,
+ * so the server peeks at a new connection for a moment before it sends
+ * anything (ws_sniff). After the upgrade the chat messages are text frames.
+ * The parser never waits for a whole frame : bytes are consumed as they
+ * come, a header may be split anywhere and payloads are unmasked straight
+ * from the read buffer into the message, sixteen or thirty-two bytes per
+ * instruction where the CPU has SSE2 / AVX2.
+ */
+
+/* HEADERS */
+#define _GNU_SOURCE /* memmem, strcasestr */
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <poll.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define WS_X86 1
+#endif
+
+#include "ws.h"
+
+/* DEFINE */
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+#define WS_KEY_LEN 24    /* base64 of the 16 byte nonce */
+#define WS_ACCEPT_LEN 28 /* base64 of a SHA-1 */
+#define WS_HEADER_VALUE_MAX 128
+
+/* FUNCTIONS */
+static int ws_read_head(WsParser *p, int sockfd);
+static int ws_header(const char *head, const char *name, char *value, size_t size);
+static void ws_accept_key(const char *key, char *out);
+static void ws_handshake_timeout(int sockfd, int sec);
+static int ws_frame_start(WsParser *p);
+#ifdef WS_X86
+static size_t ws_mask_sse2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key);
+static size_t ws_mask_avx2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key);
+#endif
+
+/* Handshake Functions */
+int ws_sniff(int sockfd, int timeout_ms) // 1 : the client spoke first with "GET ", 0 : a native client
+{
+    struct pollfd pfd = {.fd = sockfd, .events = POLLIN};
+    struct timespec start, now;
+    char head[4];
+    int waited_ms = 0;
+    ssize_t n;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (poll(&pfd, 1, timeout_ms - waited_ms) > 0)
+    {
+        if ((n = recv(sockfd, head, sizeof(head), MSG_PEEK)) <= 0 || memcmp(head, "GET ", n) != 0)
+            return 0;
+        if (n == sizeof(head))
+            return 1;
+        usleep(1000); // "G", "GE" ... the rest of the request line is on its way
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if ((waited_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000) >= timeout_ms)
+            break;
+    }
+    return 0;
+}
+
+/* server side : reads the upgrade request into p, answers 101 or 400, returns 0 or -1 */
+int ws_accept(WsParser *p, int sockfd)
+{
+    static const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nSec-WebSocket-Version: 13\r\n"
+                                      "Connection: close\r\nContent-Length: 0\r\n\r\n";
+    char value[WS_HEADER_VALUE_MAX], key[WS_HEADER_VALUE_MAX], accept[WS_ACCEPT_LEN + 1];
+    char response[256];
+    const char *head = (const char *)p->in;
+    int ret = -1;
+
+    ws_handshake_timeout(sockfd, WS_HANDSHAKE_TIMEOUT_SEC);
+    if (ws_read_head(p, sockfd) == 0 && strncmp(head, "GET ", 4) == 0 && strstr(head, " HTTP/1.1\r\n") != NULL &&
+        ws_header(head, "Upgrade", value, sizeof(value)) == 0 && strcasestr(value, "websocket") != NULL &&
+        ws_header(head, "Connection", value, sizeof(value)) == 0 && strcasestr(value, "upgrade") != NULL &&
+        ws_header(head, "Sec-WebSocket-Version", value, sizeof(value)) == 0 && strcmp(value, "13") == 0 &&
+        ws_header(head, "Sec-WebSocket-Key", key, sizeof(key)) == 0 && strlen(key) == WS_KEY_LEN)
+    {
+        ws_accept_key(key, accept);
+        snprintf(response, sizeof(response),
+                 "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                 "Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+        ret = (send_all(sockfd, response, strlen(response)) < 0) ? -1 : 0;
+    }
+    else
+        send_all(sockfd, bad_request, sizeof(bad_request) - 1);
+    ws_handshake_timeout(sockfd, 0);
+    return ret;
+}
+
+/* client side : sends the upgrade request, checks the 101 answer, returns 0 or -1 */
+int ws_connect(WsParser *p, int sockfd, const char *host)
+{
+    uint8_t nonce[16];
+    char key[WS_KEY_LEN + 1], accept[WS_ACCEPT_LEN + 1], value[WS_HEADER_VALUE_MAX];
+    char request[512];
+    int ret = -1;
+
+    if (RAND_bytes(nonce, sizeof(nonce)) != 1)
+        return -1;
+    EVP_EncodeBlock((unsigned char *)key, nonce, sizeof(nonce));
+    snprintf(request, sizeof(request),
+             "GET / HTTP/1.1\r\nHost: %s\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+             "Sec-WebSocket-Key: %s\r\nSec-WebSocket-Version: 13\r\n\r\n", host, key);
+    ws_accept_key(key, accept);
+
+    ws_handshake_timeout(sockfd, WS_HANDSHAKE_TIMEOUT_SEC);
+    if (send_all(sockfd, request, strlen(request)) >= 0 && ws_read_head(p, sockfd) == 0 &&
+        strncmp((const char *)p->in, "HTTP/1.1 101", 12) == 0 &&
+        ws_header((const char *)p->in, "Sec-WebSocket-Accept", value, sizeof(value)) == 0 && strcmp(value, accept) == 0)
+        ret = 0;
+    ws_handshake_timeout(sockfd, 0);
+    return ret;
+}
+
+/* reads up to the blank line, in_pos then points at the first frame byte (a server may send one right away) */
+static int ws_read_head(WsParser *p, int sockfd)
+{
+    uint8_t *end = NULL;
+    ssize_t n;
+
+    p->in_pos = p->in_len = 0;
+    while (end == NULL && p->in_len < sizeof(p->in) - 1)
+    {
+        if ((n = recv(sockfd, p->in + p->in_len, sizeof(p->in) - 1 - p->in_len, 0)) <= 0)
+            return -1;
+        p->in_len += n;
+        end = memmem(p->in, p->in_len, "\r\n\r\n", 4);
+    }
+    if (end == NULL)
+        return -1;
+    end[2] = '\0'; // the header block becomes a string, each line still ends with "\r\n"
+    p->in_pos = end + 4 - p->in;
+    return 0;
+}
+
+static int ws_header(const char *head, const char *name, char *value, size_t size) // 0 : found, value trimmed
+{
+    size_t name_len = strlen(name), len;
+    const char *line = strstr(head, "\r\n"), *end;
+
+    for (; line != NULL; line = strstr(line, "\r\n"))
+    {
+        line += 2;
+        if (strncasecmp(line, name, name_len) != 0 || line[name_len] != ':')
+            continue;
+        line += name_len + 1;
+        line += strspn(line, " \t");
+        if ((end = strstr(line, "\r\n")) == NULL)
+            return -1;
+        while (end > line && (end[-1] == ' ' || end[-1] == '\t'))
+            end--;
+        len = ((size_t)(end - line) < size - 1) ? (size_t)(end - line) : size - 1;
+        memcpy(value, line, len);
+        value[len] = '\0';
+        return 0;
+    }
+    return -1;
+}
+
+static void ws_accept_key(const char *key, char *out) // base64(SHA-1(key + GUID)), out holds WS_ACCEPT_LEN + 1
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    char buf[WS_HEADER_VALUE_MAX + sizeof(WS_GUID)];
+    int len = snprintf(buf, sizeof(buf), "%s%s", key, WS_GUID);
+
+    EVP_Digest(buf, len, digest, NULL, EVP_sha1(), NULL);
+    EVP_EncodeBlock((unsigned char *)out, digest, 20);
+}
+
+static void ws_handshake_timeout(int sockfd, int sec) // 0 : back to blocking without a timeout
+{
+    struct timeval tv = {.tv_sec = sec};
+
+    setsockopt(sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sockfd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* Parser Functions */
+void ws_parser_init(WsParser *p, int expect_masked)
+{
+    memset(p, 0, sizeof(*p));
+    p->expect_masked = expect_masked;
+    p->msg_opcode = WS_OP_CONT;
+}
+
+/*
+ * consumes in[in_pos .. in_len), returns an opcode once a data message is
+ * complete (msg) or a control frame arrived (ctl), 0 when every byte is used
+ * up and more are needed, -1 on a protocol violation (close_code says which)
+ */
+int ws_parse(WsParser *p)
+{
+    while (1)
+    {
+        size_t avail = p->in_len - p->in_pos;
+
+        if (!p->in_payload) // frame header, 2 .. 14 bytes
+        {
+            size_t n;
+
+            if (p->head_need == 0)
+            {
+                p->head_len = 0;
+                p->head_need = 2;
+            }
+            n = (avail < p->head_need - p->head_len) ? avail : p->head_need - p->head_len;
+            memcpy(p->head + p->head_len, p->in + p->in_pos, n);
+            p->head_len += n;
+            p->in_pos += n;
+            if (p->head_len < p->head_need)
+                return 0;
+            if (p->head_len == 2)
+            {
+                int masked = p->head[1] >> 7, len7 = p->head[1] & 0x7F;
+
+                if ((p->head[0] & 0x70) != 0 || masked != p->expect_masked) // no extensions were negotiated
+                {
+                    p->close_code = WS_CLOSE_PROTOCOL;
+                    return -1;
+                }
+                p->head_need = 2 + ((len7 == 126) ? 2 : (len7 == 127) ? 8 : 0) + (masked ? 4 : 0);
+                if (p->head_need > 2)
+                    continue;
+            }
+            if (ws_frame_start(p) < 0)
+                return -1;
+            p->in_payload = 1;
+            avail = p->in_len - p->in_pos;
+        }
+
+        /* payload, possibly empty, unmasked on the way out of the read buffer */
+        uint64_t left = p->payload_len - p->payload_got;
+        size_t n = (avail < left) ? avail : (size_t)left;
+        uint8_t *dst = (p->opcode & 0x8) ? p->ctl + p->payload_got : p->msg + p->msg_len + p->payload_got;
+
+        if (p->expect_masked)
+            ws_mask(dst, p->in + p->in_pos, n, p->mask, p->payload_got);
+        else
+            memcpy(dst, p->in + p->in_pos, n);
+        p->in_pos += n;
+        p->payload_got += n;
+        if (p->payload_got < p->payload_len)
+            return 0;
+
+        p->in_payload = 0;
+        p->head_need = 0;
+        if (p->opcode & 0x8)
+        {
+            p->ctl_len = p->payload_len;
+            return p->opcode;
+        }
+        p->msg_len += p->payload_len;
+        if (p->fin)
+        {
+            int opcode = p->msg_opcode;
+
+            p->msg[p->msg_len] = '\0';
+            p->msg_opcode = WS_OP_CONT;
+            return opcode;
+        }
+    }
+}
+
+static int ws_frame_start(WsParser *p) // the header is complete : length, mask and the frame sequence rules
+{
+    uint8_t *ext = p->head + 2;
+    int len7 = p->head[1] & 0x7F;
+
+    p->fin = p->head[0] >> 7;
+    p->opcode = p->head[0] & 0x0F;
+    p->payload_got = 0;
+    p->close_code = WS_CLOSE_PROTOCOL;
+    if (len7 == 126)
+    {
+        p->payload_len = ((uint64_t)ext[0] << 8) | ext[1];
+        ext += 2;
+    }
+    else if (len7 == 127)
+    {
+        p->payload_len = 0;
+        for (int i = 0; i < 8; i++)
+        {
+            p->payload_len = (p->payload_len << 8) | ext[i];
+        }
+        ext += 8;
+        if (p->payload_len >> 63)
+            return -1;
+    }
+    else
+        p->payload_len = len7;
+    if (p->expect_masked)
+        memcpy(p->mask, ext, 4);
+
+    if (p->opcode & 0x8) // control frames : unfragmented, short, may sit between the fragments of a message
+    {
+        if (!p->fin || p->payload_len > WS_CONTROL_MAX ||
+            (p->opcode != WS_OP_CLOSE && p->opcode != WS_OP_PING && p->opcode != WS_OP_PONG) ||
+            (p->opcode == WS_OP_CLOSE && p->payload_len == 1))
+            return -1;
+    }
+    else
+    {
+        if (p->opcode == WS_OP_CONT ? (p->msg_opcode == WS_OP_CONT)
+                                    : (p->msg_opcode != WS_OP_CONT || (p->opcode != WS_OP_TEXT && p->opcode != WS_OP_BINARY)))
+            return -1;
+        if (p->opcode != WS_OP_CONT)
+        {
+            p->msg_opcode = p->opcode;
+            p->msg_len = 0;
+        }
+        if (p->payload_len > WS_MESSAGE_MAX - p->msg_len)
+        {
+            p->close_code = WS_CLOSE_TOO_BIG;
+            return -1;
+        }
+    }
+    p->close_code = 0;
+    return 0;
+}
+
+/* like ws_parse() but reads from conn as needed, returns an opcode, 0 on EOF, -1 on errors */
+int ws_read(WsParser *p, Conn *conn)
+{
+    int event;
+    ssize_t n;
+
+    while ((event = ws_parse(p)) == 0)
+    {
+        p->in_pos = p->in_len = 0; // ws_parse() only asks for more once everything is consumed
+        if ((n = conn_recv(conn, p->in, sizeof(p->in))) <= 0)
+            return n;
+        p->in_len = n;
+    }
+    return event;
+}
+
+/* Frame Functions */
+size_t ws_frame_header(uint8_t *out, int opcode, size_t len, const uint8_t *mask) // FIN set, mask NULL : server frame
+{
+    size_t n = 2;
+
+    out[0] = 0x80 | opcode;
+    out[1] = (mask != NULL) ? 0x80 : 0;
+    if (len < 126)
+        out[1] |= len;
+    else if (len <= 0xFFFF)
+    {
+        out[1] |= 126;
+        out[n++] = len >> 8;
+        out[n++] = len & 0xFF;
+    }
+    else
+    {
+        out[1] |= 127;
+        for (int i = 7; i >= 0; i--)
+        {
+            out[n++] = ((uint64_t)len >> (8 * i)) & 0xFF;
+        }
+    }
+    if (mask != NULL)
+    {
+        memcpy(out + n, mask, 4);
+        n += 4;
+    }
+    return n;
+}
+
+size_t ws_frame_build(uint8_t *out, size_t size, int opcode, const void *payload, size_t len, const uint8_t *mask)
+{
+    size_t n;
+
+    if (len + WS_FRAME_OVERHEAD > size)
+        return 0;
+    n = ws_frame_header(out, opcode, len, mask);
+    if (mask != NULL)
+        ws_mask(out + n, payload, len, mask, 0);
+    else
+        memcpy(out + n, payload, len);
+    return n + len;
+}
+
+size_t ws_close_build(uint8_t *out, size_t size, int code, const uint8_t *mask)
+{
+    uint8_t payload[2] = {code >> 8, code & 0xFF};
+
+    return ws_frame_build(out, size, WS_OP_CLOSE, payload, sizeof(payload), mask);
+}
+
+/* dst[i] = src[i] ^ mask[(phase + i) % 4], dst may be src */
+void ws_mask(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t *mask, size_t phase)
+{
+    uint8_t rot[4] = {mask[phase & 3], mask[(phase + 1) & 3], mask[(phase + 2) & 3], mask[(phase + 3) & 3]};
+    uint32_t key;
+    size_t i = 0;
+
+    memcpy(&key, rot, 4); // byte order does not matter, the key goes back to memory the same way
+#ifdef WS_X86
+    if (len >= 32 && __builtin_cpu_supports("avx2"))
+        i = ws_mask_avx2(dst, src, len, key);
+    else if (len >= 16)
+        i = ws_mask_sse2(dst, src, len, key);
+#endif
+    for (; i + 8 <= len; i += 8) // blocks of 4 keep the phase, so the rotated key still lines up
+    {
+        uint64_t word, key64 = ((uint64_t)key << 32) | key;
+
+        memcpy(&word, src + i, 8);
+        word ^= key64;
+        memcpy(dst + i, &word, 8);
+    }
+    for (; i < len; i++)
+    {
+        dst[i] = src[i] ^ rot[i & 3];
+    }
+}
+
+#ifdef WS_X86
+__attribute__((target("sse2"))) static size_t ws_mask_sse2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    __m128i k = _mm_set1_epi32((int)key);
+    size_t i = 0;
+
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_xor_si128(v, k));
+    }
+    return i;
+}
+
+__attribute__((target("avx2"))) static size_t ws_mask_avx2(uint8_t *dst, const uint8_t *src, size_t len, uint32_t key)
+{
+    __m256i k = _mm256_set1_epi32((int)key);
+    size_t i = 0;
+
+    for (; i + 32 <= len; i += 32)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_xor_si256(v, k));
+    }
+    return i;
+}
+#endif
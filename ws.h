@@ -0,0 +1,79 @@
+/***
+ * @file ws.h
+ * @brief WebSocket (RFC 6455) gateway : upgrade handshake, incremental frame parser, SIMD unmasking
+ * @date 2026-10-19
+ * @author GeonhaPark <geonhab504@gmail.com>
+ */
+
+#ifndef WS_H
+#define WS_H
+
+/* HEADERS */
+#include <sys/types.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "chat_proto.h"
+#include "conn.h"
+
+/* DEFINE */
+#define WS_SNIFF_MS 20            /* how long a new connection may take to show "GET " before it is a native client */
+#define WS_HANDSHAKE_TIMEOUT_SEC 5
+#define WS_READ_SIZE 4096         /* socket reads, also holds the whole HTTP upgrade request */
+#define WS_MESSAGE_MAX MESSAGE_MAX_LEN /* longest reassembled data message */
+#define WS_CONTROL_MAX 125
+#define WS_FRAME_OVERHEAD 14      /* longest header : 2 + 8 length + 4 mask */
+
+enum
+{
+    WS_OP_CONT = 0x0,
+    WS_OP_TEXT = 0x1,
+    WS_OP_BINARY = 0x2,
+    WS_OP_CLOSE = 0x8,
+    WS_OP_PING = 0x9,
+    WS_OP_PONG = 0xA
+};
+
+enum
+{
+    WS_CLOSE_NORMAL = 1000,
+    WS_CLOSE_PROTOCOL = 1002,
+    WS_CLOSE_UNSUPPORTED = 1003,
+    WS_CLOSE_TOO_BIG = 1009
+};
+
+/* STRUCTS */
+typedef struct
+{
+    int expect_masked;                 // 1 : server side, clients must mask every frame
+    uint8_t in[WS_READ_SIZE];          // bytes read but not parsed yet : in[in_pos .. in_len)
+    size_t in_pos, in_len;
+    uint8_t head[WS_FRAME_OVERHEAD];   // header of the current frame, it may arrive in pieces
+    size_t head_len, head_need;        // head_need 0 : between frames
+    int in_payload;                    // 1 : header done, payload_got of payload_len bytes copied
+    int opcode, fin;
+    uint64_t payload_len, payload_got;
+    uint8_t mask[4];
+    int msg_opcode;                    // data message being reassembled, WS_OP_CONT : none
+    uint8_t msg[WS_MESSAGE_MAX + 1];   // reassembled data message, '\0' terminated
+    size_t msg_len;
+    uint8_t ctl[WS_CONTROL_MAX];       // payload of the current control frame
+    size_t ctl_len;
+    int close_code;                    // why ws_parse() failed, to send back in a close frame
+} WsParser;
+
+/* FUNCTIONS */
+int ws_sniff(int sockfd, int timeout_ms);
+int ws_accept(WsParser *p, int sockfd);
+int ws_connect(WsParser *p, int sockfd, const char *host);
+
+void ws_parser_init(WsParser *p, int expect_masked);
+int ws_parse(WsParser *p);
+int ws_read(WsParser *p, Conn *conn);
+
+size_t ws_frame_header(uint8_t *out, int opcode, size_t len, const uint8_t *mask);
+size_t ws_frame_build(uint8_t *out, size_t size, int opcode, const void *payload, size_t len, const uint8_t *mask);
+size_t ws_close_build(uint8_t *out, size_t size, int code, const uint8_t *mask);
+void ws_mask(uint8_t *dst, const uint8_t *src, size_t len, const uint8_t *mask, size_t phase);
+
+#endif